@@ -32,6 +32,7 @@
 #include "MainAppWindow.h"
 
 #include "mammut.h"
+#include "export.h"
 
 
 //==============================================================================
@@ -87,6 +88,9 @@ public:
 
     void shutdown()
     {
+        // Let the saves in the background finish their files.
+        EXPORT_waitAll();
+
         delete theMainWindow;
         theMainWindow = 0;
     }
@@ -33,6 +33,7 @@
 #include "PictureHolder.h"
 #include "Interface.h"
 #include "juceplay.h"
+#include "preanalyze.h"
 
 static uint32 paintduration=0;
 static uint32 lastrepaint=0;
@@ -646,8 +647,11 @@ void Interface::buttonClicked (Button* buttonThatWasClicked)
       if(savefilename==NULL)
 	buttonClicked(saveasbutton);
       else{
-	MC_stop();
-	MC_synthAndSave(savefilename);
+	char *error=MC_synthAndSave(savefilename);
+	if(error!=NULL)
+	  AlertWindow::showMessageBox (AlertWindow::WarningIcon,
+				       T("Mammut"),
+				       String(error) + T(" (") + String((const char*)savefilename) + T(")"));
       }
         //[/UserButtonCode_savebutton]
     }
@@ -762,7 +766,6 @@ void Interface::buttonClicked (Button* buttonThatWasClicked)
 	  File mooseFile (myChooser.getResult());
 	  savefilename=(char*)mooseFile.getFullPathName().toUTF8();
 	  printf("Filename: %s\n",savefilename);
-	  MC_stop();
 	  char *error=MC_synthAndSave(savefilename);
 	  if(error!=NULL){
 	    AlertWindow::showMessageBox (AlertWindow::WarningIcon,
@@ -869,7 +872,7 @@ void Interface::sliderValueChanged (Slider* sliderThatWasMoved)
     else if (sliderThatWasMoved == playposslider)
     {
         //[UserSliderCode_playposslider] -- add your slider handling code here..
-      jp_playpos=(int)((playposslider->getValue()/256.0f)*N);
+      jp_playpos=(int)((playposslider->getValue()/256.0f)*jp_playlength);
         //[/UserSliderCode_playposslider]
     }
 }
@@ -905,6 +908,8 @@ void Interface::comboBoxChanged (ComboBox* comboBoxThatHasChanged)
 
       sprintf(lastvalid,loadcomboBox->getText().toUTF8());
 
+      preAnalyze();
+
         //[/UserComboBoxCode_loadcomboBox]
     }
     else if (comboBoxThatHasChanged == loadmulcomboBox)
@@ -936,6 +941,8 @@ void Interface::comboBoxChanged (ComboBox* comboBoxThatHasChanged)
 
       sprintf(lastvalid,loadmulcomboBox->getText().toUTF8());
 
+      preAnalyze();
+
         //[/UserComboBoxCode_loadmulcomboBox]
     }
 }
@@ -991,6 +998,26 @@ void Interface::addUndo(void){
   //printf("ai? %d %d %d\n",undolevel,(int)undoredoinc->getMaxValue(),(int)undoredoslider->getMaxValue());
 }
 
+/* The sounds in the histories of the load comboboxes are analyzed in the
+   background, the latest first, so that going back to them is quick. */
+void Interface::preAnalyze(void){
+  StringArray names;
+  const char *filenames[8];
+  int i,num;
+
+  for(i=loadcomboBox->getNumItems()-1;i>=0;i--)
+    if(loadcomboBox->getItemText(i)!=loadcomboBox->getText())
+      names.addIfNotAlreadyThere(loadcomboBox->getItemText(i));
+  for(i=loadmulcomboBox->getNumItems()-1;i>=0;i--)
+    names.addIfNotAlreadyThere(loadmulcomboBox->getItemText(i));
+
+  num=mammut_min(names.size(),8);
+  for(i=0;i<num;i++)
+    filenames[i]=names[i].toUTF8();
+
+  PREANALYZE_start(filenames,num);
+}
+
 char *Interface::loadFileMul(char *das_filename){
   MC_stop();
   char *error=MC_addUndo();
@@ -1120,7 +1147,7 @@ void Interface::timerCallback(){
   if(jp_isplaying){
     double playpos=256.0;
     playpos*=jp_playpos;
-    playpos/=N;
+    playpos/=jp_playlength;
     playposslider->setValue(playpos,false);
     wasplaying=true;
   }else if(wasplaying){
@@ -55,6 +55,7 @@ public:
     void addUndo(void);
     bool loadFile(char *das_filename);
     char *loadFileMul(char *das_filename);
+    void preAnalyze(void);
     bool filewasjustsaved;
     void timerCallback();
     void run();
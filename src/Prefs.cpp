@@ -34,7 +34,13 @@ Prefs::Prefs ()
       animationButton (0),
       pictureButton (0),
       loopButton (0),
-      audioSettingsButton (0)
+      audioSettingsButton (0),
+      fftthreadsLabel (0),
+      fftthreadsSlider (0),
+      speccacheLabel (0),
+      speccacheSlider (0),
+      saverateLabel (0),
+      saverateSlider (0)
 {
     addAndMakeVisible (soundonoffButton = new ToggleButton (T("new toggle button")));
     soundonoffButton->setButtonText (T("Startup Sound"));
@@ -66,7 +72,52 @@ Prefs::Prefs ()
     audioSettingsButton->addButtonListener (this);
     audioSettingsButton->setColour (TextButton::buttonColourId, Colour (0x21bbbbff));
 
-    setSize (200, 230);
+    addAndMakeVisible (fftthreadsLabel = new Label (T("new label"),
+                                                    T("FFT Threads")));
+    fftthreadsLabel->setFont (Font (15.0000f, Font::plain));
+    fftthreadsLabel->setJustificationType (Justification::centredLeft);
+    fftthreadsLabel->setEditable (false, false, false);
+    fftthreadsLabel->setColour (TextEditor::textColourId, Colours::black);
+    fftthreadsLabel->setColour (TextEditor::backgroundColourId, Colour (0x0));
+
+    addAndMakeVisible (fftthreadsSlider = new Slider (T("new slider")));
+    fftthreadsSlider->setTooltip (T("Number of threads used for analysis and synthesis. 0 means one thread per CPU."));
+    fftthreadsSlider->setRange (0, 64, 1);
+    fftthreadsSlider->setSliderStyle (Slider::IncDecButtons);
+    fftthreadsSlider->setTextBoxStyle (Slider::TextBoxLeft, false, 40, 20);
+    fftthreadsSlider->addListener (this);
+
+    addAndMakeVisible (speccacheLabel = new Label (T("new label"),
+                                                   T("Spectrum Cache MB")));
+    speccacheLabel->setFont (Font (15.0000f, Font::plain));
+    speccacheLabel->setJustificationType (Justification::centredLeft);
+    speccacheLabel->setEditable (false, false, false);
+    speccacheLabel->setColour (TextEditor::textColourId, Colours::black);
+    speccacheLabel->setColour (TextEditor::backgroundColourId, Colour (0x0));
+
+    addAndMakeVisible (speccacheSlider = new Slider (T("new slider")));
+    speccacheSlider->setTooltip (T("Disk space used for remembering the analysis of sounds, so that loading them again is quick. 0 turns it off."));
+    speccacheSlider->setRange (0, 1048576, 512);
+    speccacheSlider->setSliderStyle (Slider::IncDecButtons);
+    speccacheSlider->setTextBoxStyle (Slider::TextBoxLeft, false, 64, 20);
+    speccacheSlider->addListener (this);
+
+    addAndMakeVisible (saverateLabel = new Label (T("new label"),
+                                                  T("Save Sample Rate")));
+    saverateLabel->setFont (Font (15.0000f, Font::plain));
+    saverateLabel->setJustificationType (Justification::centredLeft);
+    saverateLabel->setEditable (false, false, false);
+    saverateLabel->setColour (TextEditor::textColourId, Colours::black);
+    saverateLabel->setColour (TextEditor::backgroundColourId, Colour (0x0));
+
+    addAndMakeVisible (saverateSlider = new Slider (T("new slider")));
+    saverateSlider->setTooltip (T("Sample rate of saved sounds, converted exactly from the spectrum. 0 saves at the rate of the loaded sound."));
+    saverateSlider->setRange (0, 384000, 1);
+    saverateSlider->setSliderStyle (Slider::IncDecButtons);
+    saverateSlider->setTextBoxStyle (Slider::TextBoxLeft, false, 64, 20);
+    saverateSlider->addListener (this);
+
+    setSize (200, 410);
 
     //[Constructor] You can add your own custom stuff here..
     propertiesfile=PropertiesFile::createDefaultAppPropertiesFile("mammut",".prefs",String::empty,false,0,PropertiesFile::storeAsXML);
@@ -79,6 +130,9 @@ Prefs::Prefs ()
     movingcameraButton->setToggleState(propertiesfile->getBoolValue(movingcameraButton->getButtonText().replaceCharacters(String(" "),String("_")),true),true);
     animationButton->setToggleState(propertiesfile->getBoolValue(animationButton->getButtonText().replaceCharacters(String(" "),String("_")),true),true);
     loopButton->setToggleState(propertiesfile->getBoolValue(loopButton->getButtonText().replaceCharacters(String(" "),String("_")),true),true);
+    fftthreadsSlider->setValue(propertiesfile->getIntValue(fftthreadsLabel->getText().replaceCharacters(String(" "),String("_")),0),true);
+    speccacheSlider->setValue(propertiesfile->getIntValue(speccacheLabel->getText().replaceCharacters(String(" "),String("_")),prefs_speccache_mb),true);
+    saverateSlider->setValue(propertiesfile->getIntValue(saverateLabel->getText().replaceCharacters(String(" "),String("_")),prefs_save_samplerate),true);
     //[/Constructor]
 }
 
@@ -93,6 +147,12 @@ Prefs::~Prefs()
     deleteAndZero (pictureButton);
     deleteAndZero (loopButton);
     deleteAndZero (audioSettingsButton);
+    deleteAndZero (fftthreadsLabel);
+    deleteAndZero (fftthreadsSlider);
+    deleteAndZero (speccacheLabel);
+    deleteAndZero (speccacheSlider);
+    deleteAndZero (saverateLabel);
+    deleteAndZero (saverateSlider);
 
     //[Destructor]. You can add your own custom destruction code here..
     //[/Destructor]
@@ -114,7 +174,13 @@ void Prefs::resized()
     animationButton->setBounds (32, 88, 150, 24);
     pictureButton->setBounds (32, 56, 150, 24);
     loopButton->setBounds (32, 152, 150, 24);
-    audioSettingsButton->setBounds (24, 192, 158, 24);
+    audioSettingsButton->setBounds (24, 372, 158, 24);
+    fftthreadsLabel->setBounds (32, 184, 150, 24);
+    fftthreadsSlider->setBounds (32, 208, 150, 24);
+    speccacheLabel->setBounds (32, 240, 150, 24);
+    speccacheSlider->setBounds (32, 264, 150, 24);
+    saverateLabel->setBounds (32, 296, 150, 24);
+    saverateSlider->setBounds (32, 320, 150, 24);
     //[UserResized] Add your own custom resize handling here..
     //[/UserResized]
 }
@@ -179,6 +245,31 @@ void Prefs::buttonClicked (Button* buttonThatWasClicked)
     }
 }
 
+void Prefs::sliderValueChanged (Slider* sliderThatWasMoved)
+{
+    if (sliderThatWasMoved == fftthreadsSlider)
+    {
+        //[UserSliderCode_fftthreadsSlider] -- add your slider handling code here..
+      prefs_fftthreads=(int)fftthreadsSlider->getValue();
+      propertiesfile->setValue(fftthreadsLabel->getText().replaceCharacters(String(" "),String("_")),prefs_fftthreads);
+        //[/UserSliderCode_fftthreadsSlider]
+    }
+    else if (sliderThatWasMoved == speccacheSlider)
+    {
+        //[UserSliderCode_speccacheSlider] -- add your slider handling code here..
+      prefs_speccache_mb=(int)speccacheSlider->getValue();
+      propertiesfile->setValue(speccacheLabel->getText().replaceCharacters(String(" "),String("_")),prefs_speccache_mb);
+        //[/UserSliderCode_speccacheSlider]
+    }
+    else if (sliderThatWasMoved == saverateSlider)
+    {
+        //[UserSliderCode_saverateSlider] -- add your slider handling code here..
+      prefs_save_samplerate=(int)saverateSlider->getValue();
+      propertiesfile->setValue(saverateLabel->getText().replaceCharacters(String(" "),String("_")),prefs_save_samplerate);
+        //[/UserSliderCode_saverateSlider]
+    }
+}
+
 
 
 //[MiscUserCode] You can add your own definitions of your custom methods or any other code here...
@@ -201,7 +292,7 @@ BEGIN_JUCER_METADATA
 <JUCER_COMPONENT documentType="Component" className="Prefs" componentName="" parentClasses="public Component"
                  constructorParams="" variableInitialisers="" snapPixels="8" snapActive="1"
                  snapShown="1" overlayOpacity="0.330000013" fixedSize="0" initialWidth="200"
-                 initialHeight="230">
+                 initialHeight="410">
   <BACKGROUND backgroundColour="9cb1886c"/>
   <TOGGLEBUTTON name="new toggle button" memberName="soundonoffButton" pos="32 24 150 24"
                 buttonText="Startup Sound" connectedEdges="0" needsCallback="1"
@@ -217,9 +308,33 @@ BEGIN_JUCER_METADATA
   <TOGGLEBUTTON name="new toggle button" memberName="loopButton" pos="32 152 150 24"
                 buttonText="Loop playing" connectedEdges="0" needsCallback="1"
                 state="1"/>
-  <TEXTBUTTON name="new button" memberName="audioSettingsButton" pos="24 192 158 24"
+  <TEXTBUTTON name="new button" memberName="audioSettingsButton" pos="24 372 158 24"
               bgColOff="21bbbbff" buttonText="Audio Settings" connectedEdges="0"
               needsCallback="1"/>
+  <LABEL name="new label" memberName="fftthreadsLabel" pos="32 184 150 24"
+         edTextCol="ff000000" edBkgCol="0" labelText="FFT Threads" editableSingleClick="0"
+         editableDoubleClick="0" focusDiscardsChanges="0" fontname="Default font"
+         fontsize="15" bold="0" italic="0" justification="33"/>
+  <SLIDER name="new slider" memberName="fftthreadsSlider" pos="32 208 150 24"
+          tooltip="Number of threads used for analysis and synthesis. 0 means one thread per CPU."
+          min="0" max="64" int="1" style="IncDecButtons" textBoxPos="TextBoxLeft"
+          textBoxEditable="1" textBoxWidth="40" textBoxHeight="20"/>
+  <LABEL name="new label" memberName="speccacheLabel" pos="32 240 150 24"
+         edTextCol="ff000000" edBkgCol="0" labelText="Spectrum Cache MB"
+         editableSingleClick="0" editableDoubleClick="0" focusDiscardsChanges="0"
+         fontname="Default font" fontsize="15" bold="0" italic="0" justification="33"/>
+  <SLIDER name="new slider" memberName="speccacheSlider" pos="32 264 150 24"
+          tooltip="Disk space used for remembering the analysis of sounds, so that loading them again is quick. 0 turns it off."
+          min="0" max="1048576" int="512" style="IncDecButtons" textBoxPos="TextBoxLeft"
+          textBoxEditable="1" textBoxWidth="64" textBoxHeight="20"/>
+  <LABEL name="new label" memberName="saverateLabel" pos="32 296 150 24"
+         edTextCol="ff000000" edBkgCol="0" labelText="Save Sample Rate"
+         editableSingleClick="0" editableDoubleClick="0" focusDiscardsChanges="0"
+         fontname="Default font" fontsize="15" bold="0" italic="0" justification="33"/>
+  <SLIDER name="new slider" memberName="saverateSlider" pos="32 320 150 24"
+          tooltip="Sample rate of saved sounds, converted exactly from the spectrum. 0 saves at the rate of the loaded sound."
+          min="0" max="384000" int="1" style="IncDecButtons" textBoxPos="TextBoxLeft"
+          textBoxEditable="1" textBoxWidth="64" textBoxHeight="20"/>
 </JUCER_COMPONENT>
 
 END_JUCER_METADATA
@@ -35,7 +35,8 @@
                                                                     //[/Comments]
 */
 class Prefs  : public Component,
-               public ButtonListener
+               public ButtonListener,
+               public SliderListener
 {
 public:
     //==============================================================================
@@ -51,6 +52,7 @@ public:
     void paint (Graphics& g);
     void resized();
     void buttonClicked (Button* buttonThatWasClicked);
+    void sliderValueChanged (Slider* sliderThatWasMoved);
 
 
     //==============================================================================
@@ -67,6 +69,12 @@ private:
     ToggleButton* pictureButton;
     ToggleButton* loopButton;
     TextButton* audioSettingsButton;
+    Label* fftthreadsLabel;
+    Slider* fftthreadsSlider;
+    Label* speccacheLabel;
+    Slider* speccacheSlider;
+    Label* saverateLabel;
+    Slider* saverateSlider;
 
     //==============================================================================
     // (prevent copy constructor and operator= being generated..)
@@ -2,6 +2,10 @@
 #include "mammut.h"
 #include "juce.h"
 #include "undo.h"
+#include "workers.h"
+#include "preanalyze.h"
+#include "render.h"
+#include "export.h"
 
 
 static void (*func)(void)=NULL;
@@ -103,7 +107,13 @@ private:
 static MyProgressBar *myprogressbar;
 
 
+/* The progress of the analysis in the background (see preanalyze.c), of
+   the sound made for playing in the background (see render.c) and of the
+   saves in the background (see export.c) is not shown here. */
+
 void GUI_aboveprogressbar(int curr,int maxvalue){
+  if(WORKERS_isQuiet())
+    return;
   if(mytask==NULL)
     mytask=new MyTask();
   if(myprogressbar==NULL)
@@ -113,7 +123,18 @@ void GUI_aboveprogressbar(int curr,int maxvalue){
 }
 
 
+void GUI_progressmessage(const char *message){
+  if(WORKERS_isQuiet())
+    return;
+  if(mytask==NULL)
+    mytask=new MyTask();
+  mytask->setStatusMessage(String(message));
+}
+
+
 void GUI_startprogressbar(int minvalue,int *valtocheck,int maxvalue){
+  if(WORKERS_isQuiet())
+    return;
   //if(mytask==NULL)
   //  mytask=new MyTask();
   if(myprogressbar==NULL)
@@ -123,6 +144,8 @@ void GUI_startprogressbar(int minvalue,int *valtocheck,int maxvalue){
 
 
 void GUI_stopprogressbar(void){
+  if(WORKERS_isQuiet())
+    return;
   myprogressbar->stop_me();
 }
 
@@ -132,6 +155,9 @@ void GUI_progressbar(int minvalue,int newvalue,int maxvalue){
   static double lastpercent=0;
   double percent;
 
+  if(WORKERS_isQuiet())
+    return;
+
   if(mytask==NULL)
     mytask=new MyTask();
 
@@ -150,21 +176,29 @@ void GUI_progressbar(int minvalue,int newvalue,int maxvalue){
 
 
 void GUI_newprocess(void das_func(void)){
+  PREANALYZE_stop();
+
   create_new_mytask();
 
   mytask->setProgress(0.0);
 
   func=das_func;
   mytask->runThread();
+
+  PREANALYZE_resume();
 }
 
 
 void Transformit(void das_func(void)){
+  PREANALYZE_stop();
+
   //CriticalSection *cs=new CriticalSection();
 
+  MC_stop();
+
   create_new_mytask();
 
-  MC_stop();
+  MC_spectrumChanging();
 
   mytask->setProgress(0.0);
 
@@ -180,14 +214,19 @@ void Transformit(void das_func(void)){
   RedrawWin();
 
   func=NULL;
+
+  RENDER_speculate();
+  PREANALYZE_resume();
 }
 
 void ReTransformit(void das_func(void)){
+  PREANALYZE_stop();
 
-  create_new_mytask();
+  MC_stop();
 
+  create_new_mytask();
 
-  MC_stop();
+  MC_spectrumChanging();
 
   UNDO_do_noredraw();
 
@@ -202,8 +241,102 @@ void ReTransformit(void das_func(void)){
   RedrawWin();
 
   func=NULL;
+
+  RENDER_speculate();
+  PREANALYZE_resume();
 }
 
 
 
+/* The saves in the background (see export.h), in a window that is shown
+   while there are any. The window can be closed while they go on. When a
+   save is finished, it is taken off the list, and an error is shown if it
+   failed. */
+
+#define EXPORTQUEUE_MAXJOBS 8
+#define EXPORTQUEUE_WIDTH 400
+#define EXPORTQUEUE_ROWHEIGHT 24
 
+class ExportQueue : public Component, public Timer
+{
+public:
+  ExportQueue() {
+    num_jobs=0;
+    setSize(EXPORTQUEUE_WIDTH,EXPORTQUEUE_ROWHEIGHT);
+  }
+
+  void paint(Graphics &g)
+  {
+    int w=getWidth()-8;
+    int h=EXPORTQUEUE_ROWHEIGHT-8;
+
+    g.fillAll(Colours::white);
+    for(int i=0;i<num_jobs;i++){
+      int y=i*EXPORTQUEUE_ROWHEIGHT+4;
+      g.setColour(Colours::lightblue);
+      g.fillRect(4,y,(int)(w*jobs[i].progress),h);
+      g.setColour(Colours::black);
+      g.drawRect(4,y,w,h);
+      g.drawText(File(String((const char*)jobs[i].filename)).getFileName(),
+		 8,y,w-8,h,Justification::centredLeft,true);
+    }
+  }
+
+  void timerCallback()
+  {
+    struct ExportStatus status;
+
+    // The message box below lets the timer go on.
+    stopTimer();
+
+    while(EXPORT_takeFinished(&status)==true)
+      if(status.error!=NULL)
+	AlertWindow::showMessageBox (AlertWindow::WarningIcon,
+				     T("Mammut"),
+				     String(status.error) + T(" (") + String((const char*)status.filename) + T(")"));
+
+    num_jobs=EXPORT_getJobs(jobs,EXPORTQUEUE_MAXJOBS);
+    if(num_jobs==0){
+      getTopLevelComponent()->setVisible(false);
+      return;
+    }
+
+    setSize(EXPORTQUEUE_WIDTH,num_jobs*EXPORTQUEUE_ROWHEIGHT);
+    repaint();
+    startTimer(100);
+  }
+
+private:
+  struct ExportStatus jobs[EXPORTQUEUE_MAXJOBS];
+  int num_jobs;
+};
+
+
+class ExportQueueWindow : public DocumentWindow
+{
+public:
+  ExportQueueWindow() : DocumentWindow(T("Saving"),Colours::lightgrey,DocumentWindow::minimiseButton|DocumentWindow::closeButton) {
+    queue=new ExportQueue();
+    setContentComponent(queue,true,true);
+  }
+
+  void closeButtonPressed()
+  {
+    setVisible(false);
+  }
+
+  ExportQueue *queue;
+};
+
+
+static ExportQueueWindow *exportqueuewindow=NULL;
+
+void GUI_showexports(void){
+  if(exportqueuewindow==NULL){
+    exportqueuewindow=new ExportQueueWindow();
+    exportqueuewindow->centreWithSize(exportqueuewindow->getWidth(),exportqueuewindow->getHeight());
+  }
+  exportqueuewindow->setVisible(true);
+  exportqueuewindow->toFront(false);
+  exportqueuewindow->queue->timerCallback();
+}
@@ -0,0 +1,271 @@
+#include "mammut.h"
+#include "bigmem.h"
+#include "workers.h"
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  ifdef __APPLE__
+#    include <sys/sysctl.h>
+#  endif
+#endif
+
+#ifndef TEMPDIR
+#  define TEMPDIR "/tmp"
+#endif
+
+
+/* Only this much of the physical memory is used for spectra before
+   switching to temporary files, to leave room for the rest of mammut
+   and the rest of the system. (in percent) */
+#define BIGMEM_RAMPERCENT 60
+
+
+struct BigMem{
+  struct BigMem *next;
+  spectrum_t *mem;
+  size_t size;
+  bool ondisk;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+};
+
+/* Protected by lock, since the memory is also allocated and freed by
+   threads in the background. (see preanalyze.c and export.c) */
+static struct BigMem *bigmems=NULL;
+static size_t bigmem_inram=0;
+
+static struct WORKERS_Lock *lock;
+
+
+
+static size_t BIGMEM_physicalMemory(void){
+#ifdef _WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength=sizeof(status);
+  if(GlobalMemoryStatusEx(&status)==0)
+    return 0;
+  return (size_t)mammut_min(status.ullTotalPhys,(DWORDLONG)SIZE_MAX);
+#elif defined(__APPLE__)
+  int64_t memsize=0;
+  size_t len=sizeof(memsize);
+  if(sysctlbyname("hw.memsize",&memsize,&len,NULL,0)!=0)
+    return 0;
+  return (size_t)memsize;
+#else
+  long pages=sysconf(_SC_PHYS_PAGES);
+  long pagesize=sysconf(_SC_PAGESIZE);
+  if(pages<=0 || pagesize<=0)
+    return 0;
+  return (size_t)pages*(size_t)pagesize;
+#endif
+}
+
+/* Must be called with lock held. */
+static bool BIGMEM_fitsInRam(size_t size){
+  size_t ram=BIGMEM_physicalMemory();
+  if(ram==0)
+    return true;
+  return bigmem_inram+size <= ram/100*BIGMEM_RAMPERCENT;
+}
+
+
+
+#ifdef _WIN32
+
+static spectrum_t *BIGMEM_mapTempFile(struct BigMem *bm){
+  char dir[MAX_PATH],name[MAX_PATH];
+
+  if(GetTempPathA(MAX_PATH,dir)==0 || GetTempFileNameA(dir,"mammut",0,name)==0)
+    return NULL;
+
+  bm->file=CreateFileA(name,GENERIC_READ|GENERIC_WRITE,0,NULL,CREATE_ALWAYS,
+		       FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE,NULL);
+  if(bm->file==INVALID_HANDLE_VALUE)
+    return NULL;
+
+  bm->mapping=CreateFileMappingA(bm->file,NULL,PAGE_READWRITE,
+				 (DWORD)((unsigned long long)bm->size>>32),(DWORD)bm->size,NULL);
+  if(bm->mapping==NULL){
+    CloseHandle(bm->file);
+    return NULL;
+  }
+
+  bm->mem=(spectrum_t*)MapViewOfFile(bm->mapping,FILE_MAP_ALL_ACCESS,0,0,bm->size);
+  if(bm->mem==NULL){
+    CloseHandle(bm->mapping);
+    CloseHandle(bm->file);
+  }
+  return bm->mem;
+}
+
+static void BIGMEM_unmapTempFile(struct BigMem *bm){
+  UnmapViewOfFile(bm->mem);
+  CloseHandle(bm->mapping);
+  CloseHandle(bm->file);
+}
+
+#else
+
+/* The file is deleted right after it is made, so it disappears by itself
+   when unmapped, even if mammut crashes. */
+static spectrum_t *BIGMEM_mapTempFile(struct BigMem *bm){
+  char name[1024];
+  void *mem;
+  int fd;
+
+  snprintf(name,sizeof(name),"%s/mammut_spectrum-XXXXXX",TEMPDIR);
+  fd=mkstemp(name);
+  if(fd==-1)
+    return NULL;
+  unlink(name);
+
+  /* Make sure the disk space is there. Running out of it later would
+     give SIGBUS when writing to the memory. */
+#if defined(__linux__)
+  if(posix_fallocate(fd,0,(off_t)bm->size)!=0){
+#else
+  if(ftruncate(fd,(off_t)bm->size)!=0){
+#endif
+    close(fd);
+    return NULL;
+  }
+
+  mem=mmap(NULL,bm->size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if(mem==MAP_FAILED)
+    return NULL;
+
+  bm->mem=(spectrum_t*)mem;
+  return bm->mem;
+}
+
+static void BIGMEM_unmapTempFile(struct BigMem *bm){
+  munmap(bm->mem,bm->size);
+}
+
+#endif
+
+
+
+static spectrum_t *BIGMEM_allocDo(size_t num,bool force_disk){
+  struct BigMem *bm;
+
+  if(num > SIZE_MAX/sizeof(spectrum_t))
+    return NULL;
+
+  bm=calloc(1,sizeof(struct BigMem));
+  if(bm==NULL)
+    return NULL;
+  bm->size=num*sizeof(spectrum_t);
+
+  /* The room is taken before calloc, so that two threads can not both
+     get the last of it. */
+  WORKERS_lock(lock);
+  if(force_disk==false && BIGMEM_fitsInRam(bm->size)){
+    bigmem_inram+=bm->size;
+    WORKERS_unlock(lock);
+    bm->mem=calloc(1,bm->size);
+    if(bm->mem==NULL){
+      WORKERS_lock(lock);
+      bigmem_inram-=bm->size;
+      WORKERS_unlock(lock);
+    }
+  }else
+    WORKERS_unlock(lock);
+
+  if(bm->mem==NULL){
+    if(BIGMEM_mapTempFile(bm)==NULL){
+      fprintf(stderr,"Could not allocate %lu bytes in memory or in a temporary file.\n",(unsigned long)bm->size);
+      free(bm);
+      return NULL;
+    }
+    bm->ondisk=true;
+  }
+
+  WORKERS_lock(lock);
+  bm->next=bigmems;
+  bigmems=bm;
+  WORKERS_unlock(lock);
+
+  return bm->mem;
+}
+
+void BIGMEM_init(void){
+  lock=WORKERS_newLock();
+}
+
+spectrum_t *BIGMEM_alloc(size_t num){
+  return BIGMEM_allocDo(num,false);
+}
+
+spectrum_t *BIGMEM_allocOnDisk(size_t num){
+  return BIGMEM_allocDo(num,true);
+}
+
+void BIGMEM_free(spectrum_t *mem){
+  struct BigMem *bm;
+  struct BigMem *prev=NULL;
+
+  if(mem==NULL)
+    return;
+
+  WORKERS_lock(lock);
+  for(bm=bigmems;bm!=NULL;bm=bm->next){
+    if(bm->mem==mem){
+      if(prev==NULL)
+	bigmems=bm->next;
+      else
+	prev->next=bm->next;
+      if(bm->ondisk==false)
+	bigmem_inram-=bm->size;
+      break;
+    }
+    prev=bm;
+  }
+  WORKERS_unlock(lock);
+
+  if(bm!=NULL){
+    if(bm->ondisk)
+      BIGMEM_unmapTempFile(bm);
+    else
+      free(bm->mem);
+    free(bm);
+    return;
+  }
+
+  fprintf(stderr,"Error in file bigmem.c function BIGMEM_free: Could not find memory\n");
+}
+
+bool BIGMEM_hasRoom(size_t num){
+  bool ret;
+
+  if(num > SIZE_MAX/sizeof(spectrum_t))
+    return false;
+
+  WORKERS_lock(lock);
+  ret=BIGMEM_fitsInRam(num*sizeof(spectrum_t));
+  WORKERS_unlock(lock);
+
+  return ret;
+}
+
+bool BIGMEM_isOnDisk(const spectrum_t *mem){
+  struct BigMem *bm;
+  bool ret=false;
+
+  WORKERS_lock(lock);
+  for(bm=bigmems;bm!=NULL;bm=bm->next)
+    if(bm->ondisk && (const char*)mem>=(const char*)bm->mem && (const char*)mem<(const char*)bm->mem+bm->size){
+      ret=true;
+      break;
+    }
+  WORKERS_unlock(lock);
+
+  return ret;
+}
@@ -0,0 +1,31 @@
+
+/* Memory for the spectra (lyd and lyd2).
+
+   If the memory does not fit in the physical memory, it is instead a
+   temporary file mapped into memory, so that mammut can work on sounds
+   larger than the RAM. Such memory is used the same way as ordinary memory,
+   but rfft uses an algorithm that does the transform in a few passes over
+   the data instead (see cfft_ooc in fft.c). The temporary files are deleted
+   when freed, or when mammut exits.
+
+   The functions can be called from any thread. */
+
+extern LANGSPEC void BIGMEM_init(void);
+
+/* Returns zeroed memory for num values, or NULL if neither memory nor
+   temporary disk space could be found. */
+extern LANGSPEC spectrum_t *BIGMEM_alloc(size_t num);
+
+/* Same, but always uses a temporary file. */
+extern LANGSPEC spectrum_t *BIGMEM_allocOnDisk(size_t num);
+
+extern LANGSPEC void BIGMEM_free(spectrum_t *mem);
+
+/* True if mem points somewhere inside memory from BIGMEM_alloc that is a
+   temporary file. */
+extern LANGSPEC bool BIGMEM_isOnDisk(const spectrum_t *mem);
+
+/* True if num more values would fit in memory, without temporary files.
+   For memory allocated some other way that should still leave room for
+   the spectra. */
+extern LANGSPEC bool BIGMEM_hasRoom(size_t num);
@@ -9,6 +9,12 @@
 #include "undo.h"
 //#include "interface.h"
 #include "tempfile.h"
+#include "speccache.h"
+#include "preanalyze.h"
+#include "render.h"
+#include "bigmem.h"
+#include "export.h"
+#include "flacjoin.h"
 
 //#include <Python.h>
 
@@ -90,6 +96,11 @@ char *MC_synthAndSave(char *filename){
   return SaveOk(filename);
 }
 
+void MC_spectrumChanging(void){
+  EXPORT_changed();
+  RENDER_changed();
+}
+
 void MC_play(void){
   juceplay_start();
   //Play();
@@ -161,7 +172,14 @@ void MC_init(void){
   mainpid=getpid();
   signal(SIGINT,finish);
 #endif
+  BIGMEM_init();
   create_tempfile();
+  fft_init();
+  SPECCACHE_init();
+  PREANALYZE_init();
+  RENDER_init();
+  EXPORT_init();
+  FLACJOIN_init();
 
   //juceplay_init();
 
@@ -115,6 +115,11 @@ extern LANGSPEC char *load_and_multiply_ok(char *filename);
 
 extern LANGSPEC void MC_init(void);
 
+/* Must be called before lyd, N, R or samps_per_frame are changed, so that
+   the sound kept for playing is made again, and the saves going on in
+   the background get a copy of the spectrum. (see render.h and export.h) */
+extern LANGSPEC void MC_spectrumChanging(void);
+
 extern LANGSPEC void MC_play(void);
 extern LANGSPEC void MC_stop(void);
 extern LANGSPEC void MC_zoom(void);
@@ -0,0 +1,336 @@
+#include "mammut.h"
+#include "workers.h"
+#include "bigmem.h"
+#include "resample.h"
+#include "render.h"
+#include "export.h"
+
+
+/* The spectrum a job reads. spectrum is lyd until EXPORT_changed copies
+   it. Protected by snapshotlock. */
+struct ExportSnapshot{
+  const spectrum_t *spectrum;
+  spectrum_t *copy;
+  int users;
+};
+
+struct ExportJob{
+  struct ExportJob *next;
+  struct WORKERS_Thread *thread;
+
+  SNDFILE *outfile;
+  int format;
+  int samplerate;
+  bool normalize;
+
+  /* The spectrum as it was when the job was started. Either the sound is
+     held, or it is made from snapshot. */
+  bool isrendered;
+  struct RenderSound rendered;
+  struct ExportSnapshot *snapshot;
+  long N;
+  int R;
+  int channels;
+
+  /* Written by the job without locking, since they are only shown. */
+  float made;
+  float written;
+
+  /* Protected by lock. */
+  struct ExportStatus status;
+};
+
+
+/* Protects the list of jobs and their status. */
+static struct WORKERS_Lock *lock;
+static struct ExportJob *jobs=NULL;
+static struct WORKERS_Event *finished;
+
+/* Protects the snapshots. Held while a job copies a channel out of one,
+   so the spectrum can not change in the middle of it. */
+static struct WORKERS_Lock *snapshotlock;
+static struct WORKERS_Event *released;
+
+/* The snapshot pointing at lyd, if any jobs are reading it. */
+static struct ExportSnapshot *current=NULL;
+
+
+
+static struct ExportSnapshot *EXPORT_takeSnapshot(void)
+{
+  struct ExportSnapshot *snapshot;
+
+  WORKERS_lock(snapshotlock);
+  if(current==NULL){
+    current=calloc(1,sizeof(struct ExportSnapshot));
+    if(current!=NULL)
+      current->spectrum=lyd;
+  }
+  snapshot=current;
+  if(snapshot!=NULL)
+    snapshot->users++;
+  WORKERS_unlock(snapshotlock);
+
+  return snapshot;
+}
+
+static void EXPORT_releaseSnapshot(struct ExportSnapshot *snapshot)
+{
+  bool last;
+
+  WORKERS_lock(snapshotlock);
+  last= --snapshot->users==0;
+  if(last==true && snapshot==current)
+    current=NULL;
+  WORKERS_unlock(snapshotlock);
+
+  if(last==true){
+    BIGMEM_free(snapshot->copy);
+    free(snapshot);
+  }
+  WORKERS_signalEvent(released);
+}
+
+
+/* Makes the sound from the snapshot, one channel at a time, and lets go
+   of the snapshot as soon as the last channel is read. Like RENDER_work. */
+static spectrum_t *EXPORT_synthesize(struct ExportJob *job,long *length)
+{
+  const long N=job->N;
+  long worksize=0;
+  spectrum_t *sound;
+  spectrum_t *work=NULL;
+  int ch;
+
+  *length=N;
+  if(job->samplerate!=job->R){
+    RESAMPLE_possible(N,job->R,job->samplerate,length);
+    worksize=RESAMPLE_worksize(N,job->R,job->samplerate);
+  }
+
+  sound=BIGMEM_alloc((size_t)*length*job->channels);
+  if(worksize>0)
+    work=BIGMEM_alloc(worksize);
+
+  if(sound==NULL || (worksize>0 && work==NULL)){
+    BIGMEM_free(sound);
+    BIGMEM_free(work);
+    EXPORT_releaseSnapshot(job->snapshot);
+    return NULL;
+  }
+
+  for(ch=0;ch<job->channels;ch++){
+    spectrum_t *x=work!=NULL ? work : sound+ch*(*length);
+
+    WORKERS_lock(snapshotlock);
+    memcpy(x,job->snapshot->spectrum+ch*N,sizeof(spectrum_t)*N);
+    WORKERS_unlock(snapshotlock);
+
+    if(ch==job->channels-1)
+      EXPORT_releaseSnapshot(job->snapshot);
+
+    if(work!=NULL)
+      RESAMPLE_synthesizeChannel(x,N,job->R,job->samplerate,sound+ch*(*length));
+    else
+      rfft(x,N/2,INVERSE);
+
+    job->made=(float)(ch+1)/job->channels;
+  }
+
+  BIGMEM_free(work);
+  return sound;
+}
+
+static bool EXPORT_write(struct ExportJob *job,const spectrum_t *sound,long length)
+{
+#ifndef SNDFILE_0
+  if(job->outfile==NULL)
+    return writesound_flac(sound,length,job->channels,job->normalize,job->status.filename,job->format,job->samplerate,&job->written);
+#endif
+  return writesound(sound,length,job->channels,job->normalize,job->outfile,job->format,&job->written);
+}
+
+static void EXPORT_thread(void *arg)
+{
+  struct ExportJob *job=arg;
+  const char *error=NULL;
+
+  if(job->isrendered==true){
+    if(EXPORT_write(job,job->rendered.sound,job->rendered.length)==false)
+      error="Could not write to disk completely";
+    RENDER_release(&job->rendered);
+  }else{
+    long length;
+    spectrum_t *sound=EXPORT_synthesize(job,&length);
+    if(sound==NULL)
+      error="Not enough memory or temporary disk space";
+    else{
+      if(EXPORT_write(job,sound,length)==false)
+	error="Could not write to disk completely";
+      BIGMEM_free(sound);
+    }
+  }
+
+  if(job->outfile!=NULL)
+    sf_close(job->outfile);
+
+  WORKERS_lock(lock);
+  job->status.finished=true;
+  job->status.error=error;
+  WORKERS_unlock(lock);
+  WORKERS_signalEvent(finished);
+}
+
+
+
+void EXPORT_init(void)
+{
+  lock=WORKERS_newLock();
+  finished=WORKERS_newEvent();
+  snapshotlock=WORKERS_newLock();
+  released=WORKERS_newEvent();
+}
+
+void EXPORT_changed(void)
+{
+  struct ExportSnapshot *snapshot;
+  spectrum_t *copy;
+
+  WORKERS_lock(snapshotlock);
+  snapshot=current;
+  current=NULL;
+  if(snapshot!=NULL)
+    snapshot->users++;
+  WORKERS_unlock(snapshotlock);
+
+  if(snapshot==NULL)
+    return;
+
+  /* The jobs only read lyd, so it can be copied while they do. */
+  copy=BIGMEM_alloc((size_t)N*samps_per_frame);
+  if(copy!=NULL){
+    memcpy(copy,lyd,sizeof(spectrum_t)*N*samps_per_frame);
+    WORKERS_lock(snapshotlock);
+    snapshot->spectrum=copy;
+    snapshot->copy=copy;
+    WORKERS_unlock(snapshotlock);
+  }else{
+    fprintf(stderr,"No memory for a copy of the spectrum. Waiting for the saves to read it.\n");
+    WORKERS_lock(snapshotlock);
+    while(snapshot->users>1){
+      WORKERS_unlock(snapshotlock);
+      WORKERS_waitEvent(released);
+      WORKERS_lock(snapshotlock);
+    }
+    WORKERS_unlock(snapshotlock);
+  }
+
+  EXPORT_releaseSnapshot(snapshot);
+}
+
+char *EXPORT_start(const char *filename,SNDFILE *outfile,int format,int samplerate,bool normalize)
+{
+  struct ExportJob *job=calloc(1,sizeof(struct ExportJob));
+  struct ExportJob **last;
+
+  if(job==NULL){
+    if(outfile!=NULL)
+      sf_close(outfile);
+    return "Not enough memory";
+  }
+
+  job->outfile=outfile;
+  job->format=format;
+  job->samplerate=samplerate;
+  job->normalize=normalize;
+  job->N=N;
+  job->R=R;
+  job->channels=samps_per_frame;
+  snprintf(job->status.filename,EXPORT_MAXNAME,"%s",filename);
+
+  job->isrendered=RENDER_hold(samplerate,&job->rendered);
+  if(job->isrendered==false){
+    job->snapshot=EXPORT_takeSnapshot();
+    if(job->snapshot==NULL){
+      if(outfile!=NULL)
+	sf_close(outfile);
+      free(job);
+      return "Not enough memory";
+    }
+  }
+
+  WORKERS_lock(lock);
+  for(last=&jobs;*last!=NULL;last=&(*last)->next);
+  *last=job;
+  WORKERS_unlock(lock);
+
+  job->thread=WORKERS_startJobThread(EXPORT_thread,job);
+
+  return NULL;
+}
+
+int EXPORT_getJobs(struct ExportStatus *status,int max)
+{
+  struct ExportJob *job;
+  int num=0;
+
+  WORKERS_lock(lock);
+  for(job=jobs;job!=NULL && num<max;job=job->next){
+    status[num]=job->status;
+    if(job->status.finished==true)
+      status[num].progress=1;
+    else if(job->isrendered==true)
+      status[num].progress=job->written;
+    else
+      status[num].progress=(job->made+job->written)/2;
+    num++;
+  }
+  WORKERS_unlock(lock);
+
+  return num;
+}
+
+bool EXPORT_takeFinished(struct ExportStatus *status)
+{
+  struct ExportJob **prev;
+  struct ExportJob *job=NULL;
+
+  WORKERS_lock(lock);
+  for(prev=&jobs;*prev!=NULL;prev=&(*prev)->next)
+    if((*prev)->status.finished==true){
+      job=*prev;
+      *prev=job->next;
+      break;
+    }
+  WORKERS_unlock(lock);
+
+  if(job==NULL)
+    return false;
+
+  WORKERS_waitThread(job->thread);
+  *status=job->status;
+  status->progress=1;
+  free(job);
+
+  return true;
+}
+
+void EXPORT_waitAll(void)
+{
+  struct ExportStatus status;
+  bool empty;
+
+  for(;;){
+    while(EXPORT_takeFinished(&status)==true)
+      if(status.error!=NULL)
+	fprintf(stderr,"%s (%s)\n",status.error,status.filename);
+
+    WORKERS_lock(lock);
+    empty= jobs==NULL;
+    WORKERS_unlock(lock);
+    if(empty==true)
+      return;
+
+    WORKERS_waitEvent(finished);
+  }
+}
@@ -0,0 +1,47 @@
+
+/* Saving in the background, so that playing, transforming and loading can
+   go on while one or more sounds are saved.
+
+   Each save is a job with a thread of its own. (see WORKERS_startJobThread)
+   It saves the spectrum as it was when the job was started. When the
+   sound kept for playing is ready at the rate of the file, the job holds
+   on to that (see RENDER_hold), or else it reads the spectrum one channel
+   at a time from a snapshot. The snapshot is lyd itself until the
+   spectrum is about to change, when EXPORT_changed copies it once for all
+   the jobs still reading it. So the spectrum is only copied if it is
+   edited during a save. */
+
+#define EXPORT_MAXNAME 1024
+
+struct ExportStatus{
+  char filename[EXPORT_MAXNAME];
+  float progress; /* 0 to 1 */
+  bool finished;
+  const char *error; /* NULL if the sound was saved. */
+};
+
+extern LANGSPEC void EXPORT_init(void);
+
+/* Must be called before lyd, N, R or samps_per_frame are changed. Waits
+   for the jobs to finish reading the spectrum if there is no memory for
+   copying it. */
+extern LANGSPEC void EXPORT_changed(void);
+
+/* Starts saving the current spectrum at samplerate to outfile, which has
+   just been opened with the sample format format, and is closed by the
+   job. For FLAC files, outfile is NULL, and the job writes the file named
+   filename. (see writesound_flac) Returns an error message if the job
+   could not be started. */
+extern LANGSPEC char *EXPORT_start(const char *filename,SNDFILE *outfile,int format,int samplerate,bool normalize);
+
+/* Copies the status of the jobs, oldest first, to status, and returns
+   how many there are. At most max are copied. Finished jobs are
+   included until taken by EXPORT_takeFinished. */
+extern LANGSPEC int EXPORT_getJobs(struct ExportStatus *status,int max);
+
+/* Removes the oldest finished job, and returns its status in status.
+   Returns false if no job has finished. */
+extern LANGSPEC bool EXPORT_takeFinished(struct ExportStatus *status);
+
+/* Waits until all the jobs are finished. */
+extern LANGSPEC void EXPORT_waitAll(void);
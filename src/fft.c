@@ -1,5 +1,8 @@
 
 #include "mammut.h"
+#include "workers.h"
+#include "fft_simd.h"
+#include "bigmem.h"
 
 
 
@@ -10,164 +13,1509 @@
    Fourier spectrum, with x[1] replaced with the real part of the Nyquist
    frequency value.  If forward is false, rfft expects x to contain a
    positive frequency spectrum arranged as before, and replaces it with
-   2*N real values.  N MUST be a power of 2. */
+   2*N real values.  N can be any size, but is fastest as a power of 2,
+   and nearly as fast with no other prime factors than 2, 3, 5 and 7. */
 
 
-static void cfft(float x[], int NC, int forward);
+/* Transforms of at least this many complex values are split between
+   the worker threads (see workers.cpp). Below that, thread startup
+   costs more than it saves. */
+#define FFT_PARALLEL_MIN (1<<16)
 
-void rfft(float x[], int N, int forward)
+/* Number of butterflies the radix-4 stages and the rfft split step
+   compute twiddles for at a time. */
+#define FFT_TWIDDLEBLOCK 256
+
+/* The bit reversal of large transforms moves tiles of 2^FFT_COBRA_BITS
+   by 2^FFT_COBRA_BITS complex values at a time (see bitreverse_tiles). */
+#define FFT_COBRA_BITS 5
+#define FFT_COBRA_TILE (1<<FFT_COBRA_BITS)
+
+
+struct twiddles;
+
+static void cfft(spectrum_t x[], int NC, int forward, int nonzero, bool inorder);
+static void cfft_transform(spectrum_t x[], int NC, int forward, const struct twiddles *tw,
+			   spectrum_t scale, int num_workers, int *progval, int nonzero, bool inorder);
+static void bitreverse_range(spectrum_t x[], int N, int i0, int i1);
+static void bitreverse_tiles(spectrum_t x[], int NC, int b0, int b1);
+static bool fft_inputorder_used(const spectrum_t x[], int NC, int nonzero);
+
+
+static int fft_num_workers(int NC)
+{
+    if ( NC < FFT_PARALLEL_MIN )
+	return 1;
+    return WORKERS_getNum();
+}
+
+/* Splits the count values [0,count) into num_workers ranges, and
+   returns range number worker in *start and *end. */
+static void fft_workerrange(int count, int worker, int num_workers, int *start, int *end)
+{
+    int per = (count + num_workers - 1) / num_workers;
+
+    *start = mammut_min(count, worker*per);
+    *end = mammut_min(count, *start + per);
+}
+
+
+
+/* TWIDDLE TABLES */
+
+/* The twiddle factor exp(2*pi*i*k/n) is the product of hi[k>>shift] and
+   lo[k&(2^shift-1)]. Both tables hold (cos,sin) pairs calculated in double
+   precision, and have about sqrt(n) entries each, so that even the
+   tables for the largest transforms only use a few hundred kilobytes.
+   The tables are made the first time a size is used, and kept. */
+
+struct twiddles{
+  struct twiddles *next;
+  int n;
+  int shift;
+  double *hi;
+  double *lo;
+};
+
+static struct twiddles *twiddles_list=NULL;
+
+/* The analysis of sounds in the background (see preanalyze.c) can call
+   twiddles_get at the same time as the rest of mammut. */
+static struct WORKERS_Lock *twiddles_lock=NULL;
+
+static const struct twiddles *twiddles_get(int n)
+{
+  struct twiddles *tw;
+  int i,numhi,numlo;
+
+    WORKERS_lock( twiddles_lock );
+
+    for ( tw = twiddles_list; tw != NULL; tw = tw->next )
+	if ( tw->n == n ) {
+	    WORKERS_unlock( twiddles_lock );
+	    return tw;
+	}
+
+    tw = erroralloc( sizeof(struct twiddles) );
+    tw->n = n;
+    for ( tw->shift = 0; (1<<(2*tw->shift)) < n; tw->shift++ )
+	;
+    numlo = 1<<tw->shift;
+    numhi = ((n-1)>>tw->shift) + 1;
+    tw->hi = erroralloc( sizeof(double)*2*numhi );
+    tw->lo = erroralloc( sizeof(double)*2*numlo );
+    for ( i = 0; i < numhi; i++ ) {
+	tw->hi[i+i] = cos( 2.*M_PI*((double)i*numlo)/n );
+	tw->hi[i+i+1] = sin( 2.*M_PI*((double)i*numlo)/n );
+    }
+    for ( i = 0; i < numlo; i++ ) {
+	tw->lo[i+i] = cos( 2.*M_PI*i/n );
+	tw->lo[i+i+1] = sin( 2.*M_PI*i/n );
+    }
+
+    tw->next = twiddles_list;
+    twiddles_list = tw;
+
+    WORKERS_unlock( twiddles_lock );
+    return tw;
+}
+
+/* Returns exp(2*pi*i*k/n) in *wr and *wi, or its conjugate if forward is false. */
+static void twiddle(const struct twiddles *tw, int k, int forward, spectrum_t *wr, spectrum_t *wi)
+{
+  const double *h = tw->hi + ((k>>tw->shift)<<1);
+  const double *l = tw->lo + ((k&((1<<tw->shift)-1))<<1);
+  double 	s;
+
+    *wr = h[0]*l[0] - h[1]*l[1];
+    s = h[0]*l[1] + h[1]*l[0];
+    *wi = forward ? s : -s;
+}
+
+
+
+/* Stores the twiddle (wr,wi) as number k of a buffer with room for tn
+   twiddles, in the layout described in fft_simd.h. */
+static void twiddle_store(spectrum_t t[], int tn, int k, spectrum_t wr, spectrum_t wi)
+{
+    t[2*k] = t[2*k+1] = wr;
+    t[2*tn+2*k] = -wi;
+    t[2*tn+2*k+1] = wi;
+}
+
+
+
+/* KERNEL SELECTION */
+
+/* The inner loops of cfft and rfft. NULL means that only the scalar
+   versions in this file are used. */
+
+static struct{
+  int (*radix4)(spectrum_t x[], int L, int n, const spectrum_t tw[], int tn, int forward, spectrum_t scale);
+  int (*split)(spectrum_t x[], int N, int i, int n, const spectrum_t tw[], int tn, int forward);
+} fft_kernels = {NULL,NULL};
+
+/* Selects the widest SIMD kernels the cpu supports. Called once at startup,
+   before any fft is done. */
+void fft_init(void)
+{
+    twiddles_lock = WORKERS_newLock();
+
+#ifdef FFT_SIMD
+    switch ( fft_simd_level() ) {
+    case FFT_SIMD_AVX512:
+	fft_kernels.radix4 = radix4_butterflies_avx512;
+	fft_kernels.split = rfft_split_avx512;
+	break;
+    case FFT_SIMD_AVX2:
+	fft_kernels.radix4 = radix4_butterflies_avx2;
+	fft_kernels.split = rfft_split_avx2;
+	break;
+    case FFT_SIMD_SSE2:
+	fft_kernels.radix4 = radix4_butterflies_sse2;
+	fft_kernels.split = rfft_split_sse2;
+	break;
+    }
+#endif
+}
+
+
+
+/* RFFT */
+
+/* The post-processing (forward) or pre-processing (inverse) step of rfft
+   for the n indexes starting at i, where i>0 and i+n-1 <= N/2. Index i is
+   combined with index N-i. The twiddles are in tw, in the layout described
+   in fft_simd.h. */
+
+static void rfft_split_butterflies_scalar(spectrum_t x[], int N, int i, int n, const spectrum_t tw[], int tn, int forward)
 {
-  float 	c1,c2,
+  spectrum_t 	c1,c2,
   		h1r,h1i,
 		h2r,h2i,
-		wr,wi,
-		wpr,wpi,
-  		temp,
-		theta;
-  float 	xr,xi;
-  int 		i,
+		wr,wi;
+  int 		k,
 		i1,i2,i3,i4,
 		N2p1;
-  //  static int 	first = 1;
 
-    theta = PI/N;
-    wr = 1.;
-    wi = 0.;
     c1 = 0.5;
-    if ( forward ) {
-	c2 = -0.5;
-	cfft( x, N, forward );
-	xr = x[0];
-	xi = x[1];
-    } else {
-	c2 = 0.5;
-	theta = -theta;
-	xr = x[1];
-	xi = 0.;
-	x[1] = 0.;
-    }
-    wpr = -2.*powf( sinf( 0.5*theta ), 2. );
-    wpi = sinf( theta );
+    c2 = forward ? -0.5 : 0.5;
     N2p1 = (N<<1) + 1;
-    for ( i = 0; i <= N>>1; i++ ) {
-	i1 = i<<1;
+    for ( k = 0; k < n; k++ ) {
+	wr = tw[2*k];
+	wi = tw[2*tn+2*k+1];
+	i1 = (i+k)<<1;
 	i2 = i1 + 1;
 	i3 = N2p1 - i2;
 	i4 = i3 + 1;
-	if ( i == 0 ) {
-	    h1r =  c1*(x[i1] + xr );
-	    h1i =  c1*(x[i2] - xi );
-	    h2r = -c2*(x[i2] + xi );
-	    h2i =  c2*(x[i1] - xr );
-	    x[i1] =  h1r + wr*h2r - wi*h2i;
-	    x[i2] =  h1i + wr*h2i + wi*h2r;
-	    xr =  h1r - wr*h2r + wi*h2i;
-	    xi = -h1i + wr*h2i + wi*h2r;
-	} else {
-	    h1r =  c1*(x[i1] + x[i3] );
-	    h1i =  c1*(x[i2] - x[i4] );
-	    h2r = -c2*(x[i2] + x[i4] );
-	    h2i =  c2*(x[i1] - x[i3] );
-	    x[i1] =  h1r + wr*h2r - wi*h2i;
-	    x[i2] =  h1i + wr*h2i + wi*h2r;
-	    x[i3] =  h1r - wr*h2r + wi*h2i;
-	    x[i4] = -h1i + wr*h2i + wi*h2r;
-	}
-	wr = (temp = wr)*wpr - wi*wpi + wr;
-	wi = wi*wpr + temp*wpi + wi;
+	h1r =  c1*(x[i1] + x[i3] );
+	h1i =  c1*(x[i2] - x[i4] );
+	h2r = -c2*(x[i2] + x[i4] );
+	h2i =  c2*(x[i1] - x[i3] );
+	x[i1] =  h1r + wr*h2r - wi*h2i;
+	x[i2] =  h1i + wr*h2i + wi*h2r;
+	x[i3] =  h1r - wr*h2r + wi*h2i;
+	x[i4] = -h1i + wr*h2i + wi*h2r;
+    }
+}
+
+/* rfft_split for the indexes start <= i < end. i==0 uses and updates
+   *xr and *xi, which hold the value that was at x[0],x[1] before the
+   step (the twiddle for i==0 is 1). */
+
+static void rfft_split(spectrum_t x[], int N, int forward, const struct twiddles *tw,
+		       int start, int end, spectrum_t *xr, spectrum_t *xi)
+{
+  spectrum_t 	twbuf[4*FFT_TWIDDLEBLOCK];
+  spectrum_t 	c1,c2,
+  		h1r,h1i,
+		h2r,h2i,
+		wr,wi;
+  int 		i,k,n,done;
+
+    if ( start == 0 && end > 0 ) {
+	c1 = 0.5;
+	c2 = forward ? -0.5 : 0.5;
+	h1r =  c1*(x[0] + *xr );
+	h1i =  c1*(x[1] - *xi );
+	h2r = -c2*(x[1] + *xi );
+	h2i =  c2*(x[0] - *xr );
+	x[0] =  h1r + h2r;
+	x[1] =  h1i + h2i;
+	*xr =  h1r - h2r;
+	*xi = -h1i + h2i;
+	start = 1;
     }
+
+    for ( i = start; i < end; i += FFT_TWIDDLEBLOCK ) {
+	n = mammut_min( FFT_TWIDDLEBLOCK, end-i );
+	for ( k = 0; k < n; k++ ) {
+	    twiddle( tw, i+k, forward, &wr, &wi );
+	    twiddle_store( twbuf, n, k, wr, wi );
+	}
+	done = 0;
+	if ( fft_kernels.split != NULL )
+	    done = fft_kernels.split( x, N, i, n, twbuf, n, forward );
+	if ( done < n )
+	    rfft_split_butterflies_scalar( x, N, i+done, n-done, twbuf + 2*done, n, forward );
+    }
+}
+
+struct rfft_job{
+  spectrum_t *x;
+  int N;
+  int forward;
+  const struct twiddles *tw;
+  spectrum_t xr,xi;
+};
+
+static void rfft_split_job(void *arg, int worker, int num_workers)
+{
+  struct rfft_job *job = arg;
+  int i0,i1;
+
+    fft_workerrange( (job->N>>1) + 1, worker, num_workers, &i0, &i1 );
+    if ( i0 < i1 )
+	rfft_split( job->x, job->N, job->forward, job->tw, i0, i1, &job->xr, &job->xi );
+}
+
+/* rfft, where only the first nonzero of the 2*N values of x can be
+   nonzero if forward is true, and are in the order of fft_inputorder if
+   inorder is true. */
+static void rfft_pruned(spectrum_t x[], int N, int forward, int nonzero, bool inorder)
+{
+  struct rfft_job job;
+
+    job.x = x;
+    job.N = N;
+    job.forward = forward;
+    if ( forward ) {
+	cfft( x, N, forward, (nonzero+1)/2, inorder );
+	job.xr = x[0];
+	job.xi = x[1];
+    } else {
+	job.xr = x[1];
+	job.xi = 0.;
+	x[1] = 0.;
+    }
+    job.tw = twiddles_get( N<<1 );
+    WORKERS_run( rfft_split_job, &job, fft_num_workers(N) );
     if ( forward )
-	x[1] = xr;
+	x[1] = job.xr;
     else
-	cfft( x, N, forward );
+	cfft( x, N, forward, N, false );
+}
+
+void rfft(spectrum_t x[], int N, int forward)
+{
+    rfft_pruned( x, N, forward, 2*N, false );
+}
+
+/* rfft of each of the channels transforms at x, x+2*N, x+4*N, etc., which
+   is how lyd and lyd2 are laid out. Transforms too small to be split
+   between the worker threads are instead done one channel per worker.
+   (Those sizes never use cfft_bluestein.) */
+
+struct rfft_channels_job{
+  spectrum_t *x;
+  int N;
+  int channels;
+  int forward;
+  int nonzero;
+  bool inorder;
+  const struct twiddles *tw, *tw2;
+};
+
+static void rfft_channels_job(void *arg, int worker, int num_workers)
+{
+  struct rfft_channels_job *job = arg;
+  spectrum_t 	*x,xr,xi;
+  int 		N = job->N,
+		ch;
+
+    for ( ch = worker; ch < job->channels; ch += num_workers ) {
+	x = job->x + 2*(size_t)N*ch;
+	if ( job->forward ) {
+	    cfft_transform( x, N, true, job->tw, 0.5/N, 1, NULL, (job->nonzero+1)/2, job->inorder );
+	    xr = x[0];
+	    xi = x[1];
+	    rfft_split( x, N, true, job->tw2, 0, (N>>1) + 1, &xr, &xi );
+	    x[1] = xr;
+	} else {
+	    xr = x[1];
+	    xi = 0.;
+	    x[1] = 0.;
+	    rfft_split( x, N, false, job->tw2, 0, (N>>1) + 1, &xr, &xi );
+	    cfft_transform( x, N, false, job->tw, 2., 1, NULL, N, false );
+	}
+    }
+}
+
+static void rfft_channels_do(spectrum_t x[], int N, int channels, int forward, int nonzero, bool inorder)
+{
+  struct rfft_channels_job job;
+  int 		ch;
+
+    if ( channels > 1 && fft_num_workers(N) == 1 && WORKERS_getNum() > 1
+	 && fft_fastsize( 2*(long)N ) == 2*(long)N ) {
+	job.x = x;
+	job.N = N;
+	job.channels = channels;
+	job.forward = forward;
+	job.nonzero = nonzero;
+	job.inorder = inorder;
+	job.tw = twiddles_get( N );
+	job.tw2 = twiddles_get( N<<1 );
+	WORKERS_run( rfft_channels_job, &job, mammut_min( channels, WORKERS_getNum() ) );
+	return;
+    }
+
+    for ( ch = 0; ch < channels; ch++ ) {
+	GUI_aboveprogressbar( ch, channels );
+	rfft_pruned( x + 2*(size_t)N*ch, N, forward, nonzero, inorder );
+    }
 }
 
-/* cfft replaces float array x containing NC complex values
-   (2*NC float values alternating real, imagininary, etc.)
+void rfft_channels(spectrum_t x[], int N, int channels, int forward)
+{
+    rfft_channels_do( x, N, channels, forward, 2*N, false );
+}
+
+/* Forward rfft_channels, where only the first nonzero values of each
+   channel can be nonzero, such as a sound followed by zero padding. If
+   inorder is true, the values have been put in the order given by
+   fft_inputorder_init(x,N,nonzero). */
+void rfft_channels_forward_pruned(spectrum_t x[], int N, int channels, int nonzero, bool inorder)
+{
+    nonzero = mammut_min( nonzero, 2*N );
+    if ( inorder && fft_inputorder_used( x, N, (nonzero+1)/2 ) == false )
+	inorder = false;
+    rfft_channels_do( x, N, channels, true, nonzero, inorder );
+}
+
+
+
+/* CFFT */
+
+/* The radix-4 butterflies for n consecutive positions k of one block.
+   The four quarters of the block (L complex values apart) hold four
+   sub-transforms in bit-reversed order. tw holds the twiddles for the
+   second, third and fourth quarter, in the layout described in fft_simd.h,
+   with room for tn twiddles in each. The first quarter is multiplied by
+   scale, which is also expected to be included in tw. */
+
+static void radix4_butterflies_scalar(spectrum_t x[], int L, int n, const spectrum_t tw[], int tn, int forward, spectrum_t scale)
+{
+  spectrum_t 	*x1 = x + 2*L, *x2 = x + 4*L, *x3 = x + 6*L;
+  const spectrum_t 	*t1 = tw, *t2 = tw + 4*tn, *t3 = tw + 8*tn;
+  spectrum_t 	ar,ai, cr,ci, dr,di, er,ei,
+		s0r,s0i, s1r,s1i, s2r,s2i, s3r,s3i;
+  int 		k,tn2 = tn+tn;
+
+    for ( k = 0; k < n+n; k += 2 ) {
+	ar = scale*x[k];
+	ai = scale*x[k+1];
+	cr = t1[k]*x1[k] + t1[tn2+k]*x1[k+1];
+	ci = t1[k]*x1[k+1] + t1[tn2+k+1]*x1[k];
+	dr = t2[k]*x2[k] + t2[tn2+k]*x2[k+1];
+	di = t2[k]*x2[k+1] + t2[tn2+k+1]*x2[k];
+	er = t3[k]*x3[k] + t3[tn2+k]*x3[k+1];
+	ei = t3[k]*x3[k+1] + t3[tn2+k+1]*x3[k];
+
+	s0r = ar + cr; s0i = ai + ci;
+	s1r = ar - cr; s1i = ai - ci;
+	s2r = dr + er; s2i = di + ei;
+	s3r = dr - er; s3i = di - ei;
+
+	x[k] = s0r + s2r;  x[k+1] = s0i + s2i;
+	x2[k] = s0r - s2r; x2[k+1] = s0i - s2i;
+	if ( forward ) {
+	    x1[k] = s1r - s3i; x1[k+1] = s1i + s3r;
+	    x3[k] = s1r + s3i; x3[k+1] = s1i - s3r;
+	} else {
+	    x1[k] = s1r + s3i; x1[k+1] = s1i - s3r;
+	    x3[k] = s1r - s3i; x3[k+1] = s1i + s3r;
+	}
+    }
+}
+
+static void radix4_butterflies(spectrum_t x[], int L, int n, const spectrum_t tw[], int tn, int forward, spectrum_t scale)
+{
+    int done = 0;
+
+    if ( fft_kernels.radix4 != NULL )
+	done = fft_kernels.radix4( x, L, n, tw, tn, forward, scale );
+    if ( done < n )
+	radix4_butterflies_scalar( x + 2*done, L, n - done, tw + 2*done, tn, forward, scale );
+}
+
+/* One stage of cfft, combining blocks of radix*L complex values.
+   Only the butterfly positions k0 <= k < k1 of the blocks starting at
+   complex index b0 <= b < b1 are done, so that a stage can be split
+   between several workers. The output is multiplied by scale. */
+
+static void cfft_stage(spectrum_t x[], int NC, int forward, const struct twiddles *tw,
+		       int radix, int L, int k0, int k1, int b0, int b1, spectrum_t scale)
+{
+  spectrum_t 	twbuf[12*FFT_TWIDDLEBLOCK];
+  spectrum_t 	ar,ai,cr,ci,wr,wi;
+  int 		b,k,kc,n,
+		stride;
+
+    if ( radix == 2 ) {
+	/* Only used for the first stage, where L is 1. */
+	for ( b = b0<<1; b < b1<<1; b += 4 ) {
+	    ar = x[b]; ai = x[b+1];
+	    cr = x[b+2]; ci = x[b+3];
+	    x[b] = scale*(ar + cr); x[b+1] = scale*(ai + ci);
+	    x[b+2] = scale*(ar - cr); x[b+3] = scale*(ai - ci);
+	}
+	return;
+    }
+
+    stride = NC/(4*L);
+    for ( kc = k0; kc < k1; kc += FFT_TWIDDLEBLOCK ) {
+	n = mammut_min( FFT_TWIDDLEBLOCK, k1-kc );
+	for ( k = 0; k < n; k++ ) {
+	    twiddle( tw, 2*(kc+k)*stride, forward, &wr, &wi );
+	    twiddle_store( twbuf, n, k, scale*wr, scale*wi );
+	    twiddle( tw, (kc+k)*stride, forward, &wr, &wi );
+	    twiddle_store( twbuf + 4*n, n, k, scale*wr, scale*wi );
+	    twiddle( tw, 3*(kc+k)*stride, forward, &wr, &wi );
+	    twiddle_store( twbuf + 8*n, n, k, scale*wr, scale*wi );
+	}
+	for ( b = b0; b < b1; b += 4*L )
+	    radix4_butterflies( x + 2*(b+kc), L, n, twbuf, n, forward, scale );
+    }
+}
+
+
+/* cfft first puts the data into bit-reversed order, and then does one
+   radix-2 stage if log2(NC) is odd, and radix-4 stages for the rest.
+   The scaling of the output is done as part of the last stage.
+
+   When splitting the work between workers, the array is cut into one
+   chunk per worker (rounded up to a power of two), and all the stages
+   that stay inside a chunk are done by the worker owning it, without
+   synchronization. The remaining stages are split between the workers
+   by butterfly position. */
+
+struct cfft_job{
+  spectrum_t *x;
+  int NC;
+  int forward;
+  const struct twiddles *tw;
+  int first_radix;
+  int P;
+  int chunk;
+  int L;
+  spectrum_t scale;
+};
+
+/* The scale to use for the stage combining blocks of size blocksize. */
+static spectrum_t cfft_stagescale(struct cfft_job *job, int blocksize)
+{
+    return blocksize == job->NC ? job->scale : 1.;
+}
+
+static void cfft_bitreverse_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_job *job = arg;
+  int 		n = job->NC/job->P,
+		i0,i1;
+
+    if ( n >= FFT_COBRA_TILE*FFT_COBRA_TILE ) {
+	fft_workerrange( n/(FFT_COBRA_TILE*FFT_COBRA_TILE), worker, num_workers, &i0, &i1 );
+	bitreverse_tiles( job->x, n, i0, i1 );
+    } else {
+	fft_workerrange( n, worker, num_workers, &i0, &i1 );
+	if ( i0 < i1 )
+	    bitreverse_range( job->x, n<<1, i0<<1, i1<<1 );
+    }
+}
+
+static void cfft_chunk_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_job *job = arg;
+  int b0,L;
+
+    for ( b0 = worker*job->chunk; b0 < job->NC; b0 += num_workers*job->chunk ) {
+	L = job->P;
+	if ( L == 1 && job->first_radix == 2 && 2 <= job->chunk ) {
+	    cfft_stage( job->x, job->NC, job->forward, job->tw, 2, 1, 0, 1,
+			b0, b0 + job->chunk, cfft_stagescale( job, 2 ) );
+	    L = 2;
+	}
+	for ( ; 4*L <= job->chunk; L <<= 2 )
+	    cfft_stage( job->x, job->NC, job->forward, job->tw, 4, L, 0, L,
+			b0, b0 + job->chunk, cfft_stagescale( job, 4*L ) );
+    }
+}
+
+static void cfft_stage_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_job *job = arg;
+  int k0,k1;
+
+    fft_workerrange( job->L, worker, num_workers, &k0, &k1 );
+    if ( k0 < k1 )
+	cfft_stage( job->x, job->NC, job->forward, job->tw, 4, job->L, k0, k1,
+		    0, job->NC, cfft_stagescale( job, 4*job->L ) );
+}
+
+
+/* FACTORS */
+
+/* The radix of each stage, for both the power of two and the mixed radix
+   transforms. (FFT_INPUTORDER_MAXFACTORS in mammut.h must be the same.) */
+
+#define FFT_MAXFACTORS 32
+
+struct fft_factors{
+  int num;
+  int f[FFT_MAXFACTORS];	/* radix of each stage, first stage first */
+};
+
+/* Returns false if NC has other prime factors than 2, 3, 5 and 7. */
+static bool fft_factorize(int NC, struct fft_factors *fac)
+{
+  static const int odd[3] = {3,5,7};
+  int 		n = NC,
+		twos = 0,
+		i;
+
+    fac->num = 0;
+    if ( n < 1 )
+	return false;
+    while ( (n & 1) == 0 ) {
+	n >>= 1;
+	twos++;
+    }
+    if ( twos & 1 )
+	fac->f[fac->num++] = 2;
+    for ( i = 0; i < twos/2; i++ )
+	fac->f[fac->num++] = 4;
+    for ( i = 0; i < 3; i++ )
+	while ( n % odd[i] == 0 ) {
+	    n /= odd[i];
+	    fac->f[fac->num++] = odd[i];
+	}
+    return n == 1;
+}
+
+/* Returns P, the size of the blocks after the first stages, which are
+   skipped when only the first nonzero values can be nonzero (see PRUNING
+   below). The radixes of the stages left are put in rest. */
+static int fft_prune(int NC, int nonzero, const struct fft_factors *fac, struct fft_factors *rest)
+{
+  int 		P = 1,
+		s,i;
+
+    /* At least one stage is left, to scale the output. */
+    for ( s = 0; s < fac->num-1 && nonzero <= NC/(P*fac->f[s]); s++ )
+	P *= fac->f[s];
+
+    rest->num = fac->num - s;
+    for ( i = 0; i < rest->num; i++ )
+	rest->f[i] = fac->f[s + i];
+    return P;
+}
+
+
+
+/* PRUNING
+
+   When only the first nonzero of the NC input values can be nonzero (the
+   zero padding after the sound in das_loadana), the first stages are
+   skipped. After the stages giving blocks of P values, each block holds
+   the P-point DFT of input values NC/P apart, and if the input is zero
+   from NC/P and up, only one of those is nonzero. The DFT of that is the
+   value repeated P times. The input is therefore put into digit-reversed
+   order as if it were a transform of NC/P values (the same order, with
+   positions P times smaller), and each value then spread out to a block
+   of P values, before doing the remaining stages. */
+
+struct cfft_spread_job{
+  spectrum_t *x;
+  int P;
+  int lo,hi;
+};
+
+static void cfft_spread_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_spread_job *job = arg;
+  spectrum_t 	vr,vi,
+		*y;
+  int 		b,b0,b1,i;
+
+    fft_workerrange( job->hi - job->lo, worker, num_workers, &b0, &b1 );
+    for ( b = job->lo + b0; b < job->lo + b1; b++ ) {
+	vr = job->x[2*b];
+	vi = job->x[2*b+1];
+	y = job->x + 2*(size_t)b*job->P;
+	for ( i = 0; i < job->P; i++ ) {
+	    y[2*i] = vr;
+	    y[2*i+1] = vi;
+	}
+    }
+}
+
+/* Spreads value b (b < NC/P) to the positions b*P <= p < (b+1)*P. This is
+   done for the highest values first, in rounds where the blocks written
+   are above all values not yet read, so that each round can be split
+   between the workers. */
+static void cfft_spread(spectrum_t x[], int NC, int P, int num_workers)
+{
+  struct cfft_spread_job job;
+
+    job.x = x;
+    job.P = P;
+    for ( job.hi = NC/P; job.hi > 0; job.hi = job.lo ) {
+	job.lo = job.hi == 1 ? 0 : (job.hi + P - 1)/P;
+	WORKERS_run( cfft_spread_job, &job, num_workers );
+    }
+}
+
+
+
+/* cfft_transform for power of two sizes. */
+
+static void cfft_pow2(spectrum_t x[], int NC, int forward, const struct twiddles *tw,
+		      spectrum_t scale, int num_workers, int *progval, int nonzero)
+{
+  struct cfft_job job;
+  struct fft_factors 	fac,
+			rest;
+  int 		log2NC,
+		chunks;
+
+    for ( log2NC = 0; (1<<log2NC) < NC; log2NC++ )
+	;
+
+    for ( chunks = 1; chunks < num_workers; chunks <<= 1 )
+	;
+
+    job.x = x;
+    job.NC = NC;
+    job.forward = forward;
+    job.tw = tw;
+    job.first_radix = (log2NC & 1) ? 2 : 4;
+    job.chunk = NC/chunks;
+    job.scale = scale;
+
+    /* The factors are the same as the stages below: first_radix, and
+       then 4s. */
+    fft_factorize( NC, &fac );
+    job.P = fft_prune( NC, nonzero, &fac, &rest );
+
+    WORKERS_run( cfft_bitreverse_job, &job, num_workers );
+    if ( job.P > 1 )
+	cfft_spread( x, NC, job.P, num_workers );
+
+    WORKERS_run( cfft_chunk_job, &job, num_workers );
+    if ( progval != NULL )
+	*progval=log(job.chunk*4)*100;
+
+    for ( job.L = job.first_radix == 2 ? 2 : 1; 4*job.L <= job.chunk; job.L <<= 2 )
+	;
+    job.L = mammut_max( job.L, job.P );
+    for ( ; 4*job.L <= NC; job.L <<= 2 ) {
+	WORKERS_run( cfft_stage_job, &job, num_workers );
+	if ( progval != NULL )
+	    *progval=log(job.L*16)*100;
+    }
+
+    /* With no stages at all, the output is not scaled yet. */
+    if ( NC == 1 ) {
+	x[0] *= scale;
+	x[1] *= scale;
+    }
+}
+
+
+
+/* MIXED RADIX CFFT */
+
+/* Sizes that are not a power of two, but have no other prime factors than
+   2, 3, 5 and 7, are done the same way: the data is put into digit-reversed
+   order, and each stage combines blocks of radix*L values, with L going
+   from 1 up to NC/radix. The factors of 2 use the radix-2 and radix-4
+   stages of the power of two transform (that is why the radix-4 digits are
+   stored bit-reversed, 0,2,1,3), and the factors 3, 5 and 7 use
+   cfft_stage_odd. */
+
+/* Returns the index of the input value that ends up at position p after
+   the digit reversal. The lowest digit of the index (for the radix of the
+   last stage) is the highest digit of the position, and so on. */
+static int fft_digitreverse_inv(const struct fft_factors *fac, int NC, int p)
+{
+  int 		s,d,
+		i = 0,
+		mult = 1,
+		M = NC;
+
+    for ( s = fac->num-1; s >= 0; s-- ) {
+	M /= fac->f[s];
+	d = p / M;
+	p -= d*M;
+	if ( fac->f[s] == 4 )
+	    d = ((d&1)<<1) | (d>>1);
+	i += d*mult;
+	mult *= fac->f[s];
+    }
+    return i;
+}
+
+/* Puts the data into digit-reversed order by following the cycles of the
+   permutation, marking the positions that are done in a bitmap.
+
+   To avoid doing a division for every digit, the factors are split in
+   two groups of about sqrt(NC) positions each, and the digit reversal of
+   both is looked up in tables. The position p = ph*nlo + pl, where pl is
+   the position within the first nlo-sized group of stages, comes from
+   index hi[ph] + nhi*lo[pl]. */
+static void cfft_digitreverse(spectrum_t x[], int NC, const struct fft_factors *fac)
+{
+  struct fft_factors 	faclo,
+			fachi;
+  unsigned char 	*done;
+  int 			*lo,*hi;
+  int 			nlo,nhi,
+			i,start,j,src;
+  spectrum_t 		tr,ti;
+
+    faclo.num = 0;
+    for ( nlo = 1; faclo.num < fac->num && (double)nlo*nlo < NC; nlo *= fac->f[faclo.num++] )
+	faclo.f[faclo.num] = fac->f[faclo.num];
+    nhi = NC/nlo;
+    fachi.num = fac->num - faclo.num;
+    for ( i = 0; i < fachi.num; i++ )
+	fachi.f[i] = fac->f[faclo.num + i];
+
+    done = calloc( NC/8 + 1, 1 );
+    lo = malloc( sizeof(int)*nlo );
+    hi = malloc( sizeof(int)*nhi );
+    if ( done == NULL || lo == NULL || hi == NULL ) {
+	printerror("Not enough memory for the fft. (%d bytes)",NC/8 + 1);
+	free( done );
+	free( lo );
+	free( hi );
+	return;
+    }
+    for ( i = 0; i < nlo; i++ )
+	lo[i] = nhi*fft_digitreverse_inv( &faclo, nlo, i );
+    for ( i = 0; i < nhi; i++ )
+	hi[i] = fft_digitreverse_inv( &fachi, nhi, i );
+
+    for ( start = 0; start < NC; start++ ) {
+	if ( done[start>>3] & (1<<(start&7)) )
+	    continue;
+	tr = x[2*start];
+	ti = x[2*start+1];
+	for ( j = start; ; j = src ) {
+	    done[j>>3] |= 1<<(j&7);
+	    src = hi[j/nlo] + lo[j%nlo];
+	    if ( src == start )
+		break;
+	    x[2*j] = x[2*src];
+	    x[2*j+1] = x[2*src+1];
+	}
+	x[2*j] = tr;
+	x[2*j+1] = ti;
+    }
+
+    free( done );
+    free( lo );
+    free( hi );
+}
+
+/* The odd radix DFTs of cfft_stage_odd. a holds the radix complex inputs
+   (with the twiddles applied), c and s the cosines and the sines of the
+   angles 2*pi*j/radix, with sign for the direction of the transform. The
+   pairs j and radix-j are combined as sums t and differences d, which
+   halves the number of multiplications. Output q is m + i*n, and output
+   radix-q is m - i*n. */
+
+#define ODD_OUT(q,mr,mi,nr,ni) do{					\
+	xb[2*(q)*L] = scale*((mr) - (ni));					\
+	xb[2*(q)*L+1] = scale*((mi) + (nr));				\
+	xb[2*(radix-(q))*L] = scale*((mr) + (ni));			\
+	xb[2*(radix-(q))*L+1] = scale*((mi) - (nr));			\
+    }while(0)
+
+static void radix3_butterfly(spectrum_t xb[], int L, const spectrum_t a[], const spectrum_t c[], const spectrum_t s[], spectrum_t scale)
+{
+  const int 	radix = 3;
+  spectrum_t 	tr = a[2] + a[4], ti = a[3] + a[5],
+		dr = a[2] - a[4], di = a[3] - a[5];
+
+    ODD_OUT( 1, a[0] + c[1]*tr, a[1] + c[1]*ti, s[1]*dr, s[1]*di );
+    xb[0] = scale*(a[0] + tr);
+    xb[1] = scale*(a[1] + ti);
+}
+
+static void radix5_butterfly(spectrum_t xb[], int L, const spectrum_t a[], const spectrum_t c[], const spectrum_t s[], spectrum_t scale)
+{
+  const int 	radix = 5;
+  spectrum_t 	t1r = a[2] + a[8], t1i = a[3] + a[9],
+		t2r = a[4] + a[6], t2i = a[5] + a[7],
+		d1r = a[2] - a[8], d1i = a[3] - a[9],
+		d2r = a[4] - a[6], d2i = a[5] - a[7];
+
+    ODD_OUT( 1, a[0] + c[1]*t1r + c[2]*t2r, a[1] + c[1]*t1i + c[2]*t2i,
+	     s[1]*d1r + s[2]*d2r, s[1]*d1i + s[2]*d2i );
+    ODD_OUT( 2, a[0] + c[2]*t1r + c[1]*t2r, a[1] + c[2]*t1i + c[1]*t2i,
+	     s[2]*d1r - s[1]*d2r, s[2]*d1i - s[1]*d2i );
+    xb[0] = scale*(a[0] + t1r + t2r);
+    xb[1] = scale*(a[1] + t1i + t2i);
+}
+
+static void radix7_butterfly(spectrum_t xb[], int L, const spectrum_t a[], const spectrum_t c[], const spectrum_t s[], spectrum_t scale)
+{
+  const int 	radix = 7;
+  spectrum_t 	t1r = a[2] + a[12], t1i = a[3] + a[13],
+		t2r = a[4] + a[10], t2i = a[5] + a[11],
+		t3r = a[6] + a[8],  t3i = a[7] + a[9],
+		d1r = a[2] - a[12], d1i = a[3] - a[13],
+		d2r = a[4] - a[10], d2i = a[5] - a[11],
+		d3r = a[6] - a[8],  d3i = a[7] - a[9];
+
+    ODD_OUT( 1, a[0] + c[1]*t1r + c[2]*t2r + c[3]*t3r, a[1] + c[1]*t1i + c[2]*t2i + c[3]*t3i,
+	     s[1]*d1r + s[2]*d2r + s[3]*d3r, s[1]*d1i + s[2]*d2i + s[3]*d3i );
+    ODD_OUT( 2, a[0] + c[2]*t1r + c[3]*t2r + c[1]*t3r, a[1] + c[2]*t1i + c[3]*t2i + c[1]*t3i,
+	     s[2]*d1r - s[3]*d2r - s[1]*d3r, s[2]*d1i - s[3]*d2i - s[1]*d3i );
+    ODD_OUT( 3, a[0] + c[3]*t1r + c[1]*t2r + c[2]*t3r, a[1] + c[3]*t1i + c[1]*t2i + c[2]*t3i,
+	     s[3]*d1r - s[1]*d2r + s[2]*d3r, s[3]*d1i - s[1]*d2i + s[2]*d3i );
+    xb[0] = scale*(a[0] + t1r + t2r + t3r);
+    xb[1] = scale*(a[1] + t1i + t2i + t3i);
+}
+
+/* Like cfft_stage, for the odd radices 3, 5 and 7. */
+
+static void cfft_stage_odd(spectrum_t x[], int NC, int forward, const struct twiddles *tw,
+			   int radix, int L, int k0, int k1, int b0, int b1, spectrum_t scale)
+{
+  spectrum_t 	twbuf[12*FFT_TWIDDLEBLOCK];
+  spectrum_t 	c[7],s[7],a[14],
+		vr,vi;
+  spectrum_t 	*xb;
+  const spectrum_t 	*t;
+  int 		b,j,k,kc,n,
+		stride = NC/(radix*L);
+
+    for ( j = 0; j < radix; j++ ) {
+	c[j] = cos( 2.*M_PI*j/radix );
+	s[j] = forward ? sin( 2.*M_PI*j/radix ) : -sin( 2.*M_PI*j/radix );
+    }
+
+    for ( kc = k0; kc < k1; kc += FFT_TWIDDLEBLOCK ) {
+	n = mammut_min( FFT_TWIDDLEBLOCK, k1-kc );
+	for ( k = 0; k < n; k++ )
+	    for ( j = 1; j < radix; j++ )
+		twiddle( tw, j*(kc+k)*stride, forward,
+			 twbuf + 2*(k*(radix-1) + j-1), twbuf + 2*(k*(radix-1) + j-1) + 1 );
+
+	for ( b = b0; b < b1; b += radix*L )
+	    for ( k = 0; k < n; k++ ) {
+		xb = x + 2*(b+kc+k);
+		t = twbuf + 2*k*(radix-1) - 2;
+		a[0] = xb[0];
+		a[1] = xb[1];
+		for ( j = 1; j < radix; j++ ) {
+		    vr = xb[2*j*L];
+		    vi = xb[2*j*L+1];
+		    a[2*j] = t[2*j]*vr - t[2*j+1]*vi;
+		    a[2*j+1] = t[2*j]*vi + t[2*j+1]*vr;
+		}
+		if ( radix == 3 )
+		    radix3_butterfly( xb, L, a, c, s, scale );
+		else if ( radix == 5 )
+		    radix5_butterfly( xb, L, a, c, s, scale );
+		else
+		    radix7_butterfly( xb, L, a, c, s, scale );
+	    }
+    }
+}
+
+struct cfft_mixed_job{
+  spectrum_t *x;
+  int NC;
+  int forward;
+  const struct twiddles *tw;
+  int radix;
+  int L;
+  spectrum_t scale;
+};
+
+/* Splits the blocks between the workers when there are enough of them,
+   and the butterfly positions inside the blocks otherwise. */
+static void cfft_mixed_stage_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_mixed_job *job = arg;
+  int 		blocksize = job->radix*job->L,
+		nblocks = job->NC/blocksize,
+		b0 = 0, b1 = job->NC,
+		k0 = 0, k1 = job->L;
+  spectrum_t 	scale = blocksize == job->NC ? job->scale : 1.;
+
+    if ( nblocks >= num_workers ) {
+	fft_workerrange( nblocks, worker, num_workers, &b0, &b1 );
+	b0 *= blocksize;
+	b1 *= blocksize;
+    } else
+	fft_workerrange( job->L, worker, num_workers, &k0, &k1 );
+
+    if ( b0 >= b1 || k0 >= k1 )
+	return;
+    if ( job->radix == 2 || job->radix == 4 )
+	cfft_stage( job->x, job->NC, job->forward, job->tw, job->radix, job->L,
+		    k0, k1, b0, b1, scale );
+    else
+	cfft_stage_odd( job->x, job->NC, job->forward, job->tw, job->radix, job->L,
+			k0, k1, b0, b1, scale );
+}
+
+static void cfft_mixed(spectrum_t x[], int NC, int forward, const struct twiddles *tw,
+		       const struct fft_factors *fac, spectrum_t scale, int num_workers, int *progval,
+		       int nonzero, bool inorder)
+{
+  struct cfft_mixed_job job;
+  struct fft_factors 	rest;
+  int 		s,
+		P;
+
+    /* Skips the first s stages (see PRUNING above). If inorder is true,
+       readsound has already done the digit reversal (see INPUT ORDER). */
+    P = fft_prune( NC, nonzero, fac, &rest );
+    s = fac->num - rest.num;
+
+    if ( inorder == false ) {
+	cfft_digitreverse( x, NC/P, &rest );
+	if ( P > 1 )
+	    cfft_spread( x, NC, P, num_workers );
+    }
+
+    job.x = x;
+    job.NC = NC;
+    job.forward = forward;
+    job.tw = tw;
+    job.scale = scale;
+    job.L = P;
+    for ( ; s < fac->num; s++ ) {
+	job.radix = fac->f[s];
+	WORKERS_run( cfft_mixed_stage_job, &job, num_workers );
+	job.L *= job.radix;
+	if ( progval != NULL )
+	    *progval=log(job.L*4)*100;
+    }
+}
+
+
+
+/* BLUESTEIN */
+
+/* Sizes with larger prime factors are done as a convolution with a chirp,
+   using nk = (n*n + k*k - (k-n)*(k-n))/2:
+
+     X[k] = c[k] * sum_n (x[n]*c[n]) * conj(c[k-n]),   c[n] = w^(n*n/2)
+
+   The convolution is done with power of two transforms of at least 2*NC-1
+   values, so this uses about eight times the memory of the data, and is
+   several times slower than the other sizes. das_loadana only uses sizes
+   that avoid it (see fft_fastsize). */
+
+static void cfft_bluestein(spectrum_t x[], int NC, int forward, spectrum_t scale, int num_workers)
+{
+  const struct twiddles *twc, *twM;
+  spectrum_t 	*a,*b,
+		cr,ci, ar,ai, br,bi;
+  int 		M,n;
+
+    for ( M = 1; M < 2*NC-1; M <<= 1 )
+	;
+
+    a = calloc( 2*(size_t)M, sizeof(spectrum_t) );
+    b = calloc( 2*(size_t)M, sizeof(spectrum_t) );
+    if ( a == NULL || b == NULL ) {
+	printerror("Not enough memory for an fft of size %d.",NC);
+	free( a );
+	free( b );
+	return;
+    }
+
+    twc = twiddles_get( 2*NC );
+    twM = twiddles_get( M );
+
+    for ( n = 0; n < NC; n++ ) {
+	twiddle( twc, (int)(((long long)n*n) % (2*NC)), forward, &cr, &ci );
+	a[2*n] = x[2*n]*cr - x[2*n+1]*ci;
+	a[2*n+1] = x[2*n]*ci + x[2*n+1]*cr;
+	b[2*n] = cr;
+	b[2*n+1] = -ci;
+	if ( n > 0 ) {
+	    b[2*(M-n)] = cr;
+	    b[2*(M-n)+1] = -ci;
+	}
+    }
+
+    cfft_pow2( a, M, true, twM, 1., num_workers, NULL, NC );
+    cfft_pow2( b, M, true, twM, 1., num_workers, NULL, M );
+    for ( n = 0; n < M; n++ ) {
+	ar = a[2*n]; ai = a[2*n+1];
+	br = b[2*n]; bi = b[2*n+1];
+	a[2*n] = ar*br - ai*bi;
+	a[2*n+1] = ar*bi + ai*br;
+    }
+    cfft_pow2( a, M, false, twM, 1./M, num_workers, NULL, M );
+
+    for ( n = 0; n < NC; n++ ) {
+	twiddle( twc, (int)(((long long)n*n) % (2*NC)), forward, &cr, &ci );
+	x[2*n] = scale*(a[2*n]*cr - a[2*n+1]*ci);
+	x[2*n+1] = scale*(a[2*n]*ci + a[2*n+1]*cr);
+    }
+
+    free( a );
+    free( b );
+}
+
+
+
+/* The transform done by cfft, with the output multiplied by scale.
+   progval is updated as the stages are done, unless it is NULL. Only
+   the first nonzero input values can be nonzero, and if inorder is true,
+   they are already in the order of fft_inputorder. */
+
+static void cfft_transform(spectrum_t x[], int NC, int forward, const struct twiddles *tw,
+			   spectrum_t scale, int num_workers, int *progval, int nonzero, bool inorder)
+{
+  struct fft_factors fac;
+
+    if ( (NC & (NC-1)) == 0 )
+	cfft_pow2( x, NC, forward, tw, scale, num_workers, progval, nonzero );
+    else if ( fft_factorize( NC, &fac ) )
+	cfft_mixed( x, NC, forward, tw, &fac, scale, num_workers, progval, nonzero, inorder );
+    else
+	cfft_bluestein( x, NC, forward, scale, num_workers );
+}
+
+/* Returns the smallest even number of at least n that rfft can do without
+   falling back to the Bluestein transform, ie. twice a number with no other
+   prime factors than 2, 3, 5 and 7. */
+long fft_fastsize(long n)
+{
+  long m,r;
+
+    for ( m = mammut_max( 1, (n+1)/2 ); ; m++ ) {
+	r = m;
+	while ( r%2 == 0 ) r /= 2;
+	while ( r%3 == 0 ) r /= 3;
+	while ( r%5 == 0 ) r /= 5;
+	while ( r%7 == 0 ) r /= 7;
+	if ( r == 1 )
+	    return 2*m;
+    }
+}
+
+
+
+/* OUT-OF-CORE CFFT */
+
+/* When x is a temporary file mapped into memory (see bigmem.h), the
+   strided access of the normal transform would make the computer read
+   the file from disk over and over. Instead, cfft_ooc uses the four-step
+   algorithm, which goes through the file only a few times, working on
+   panels of the data that fit in memory:
+
+   The NC values are seen as an n1 x n2 matrix, x[j1*n2 + j2], and
+
+   1. The n1-point transform of each column j2 is done, and value k1 of
+      the result is multiplied by the twiddle w_NC^(j2*k1).
+   2. The n2-point transform of each row k1 is done, and the result is
+      written transposed to a temporary file, to give the output in order.
+   3. The temporary file is copied back to x.
+
+   The transforms of the columns and rows are split between the workers. */
+
+/* Spectra at least this large (in complex values) that are in temporary
+   files use cfft_ooc. */
+#ifndef FFT_OOC_MIN
+#define FFT_OOC_MIN (1<<20)
+#endif
+
+/* Number of complex values in the panels that are kept in memory. (128MB) */
+#ifndef FFT_OOC_PANEL
+#define FFT_OOC_PANEL (1<<24)
+#endif
+
+struct cfft_ooc_job{
+  spectrum_t *x;
+  spectrum_t *panel;
+  spectrum_t *out;
+  int NC;
+  int n1,n2;
+  int forward;
+  spectrum_t scale;
+  const struct twiddles *tw,*tw1,*tw2;
+  int start;		/* first column (step 1) or row (step 2) of the panel */
+  int count;		/* number of columns or rows in the panel, which is
+			   less for the last panel when they do not divide
+			   n2 or n1 evenly */
+};
+
+/* Step 1: copies the columns start..start+count-1 into the panel, one
+   column after another, transforms them, multiplies with the twiddles,
+   and copies them back. */
+static void cfft_ooc_columns_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_ooc_job *job = arg;
+  int n1 = job->n1, n2 = job->n2;
+  spectrum_t *p;
+  spectrum_t wr,wi,re,im;
+  int c0,c1,c,j1,k1;
+
+    fft_workerrange( job->count, worker, num_workers, &c0, &c1 );
+    for ( c = c0; c < c1; c++ ) {
+	p = job->panel + 2*(size_t)c*n1;
+	for ( j1 = 0; j1 < n1; j1++ ) {
+	    const spectrum_t *s = job->x + 2*((size_t)j1*n2 + job->start + c);
+	    p[2*j1] = s[0];
+	    p[2*j1+1] = s[1];
+	}
+	cfft_transform( p, n1, job->forward, job->tw1, 1., 1, NULL, n1, false );
+	for ( k1 = 0; k1 < n1; k1++ ) {
+	    twiddle( job->tw, (job->start + c)*k1, job->forward, &wr, &wi );
+	    wr *= job->scale;
+	    wi *= job->scale;
+	    re = p[2*k1];
+	    im = p[2*k1+1];
+	    p[2*k1] = wr*re - wi*im;
+	    p[2*k1+1] = wr*im + wi*re;
+	}
+    }
+}
+
+static void cfft_ooc_columns_store_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_ooc_job *job = arg;
+  int n1 = job->n1, n2 = job->n2;
+  int j0,j1,j,c;
+
+    /* Split by row, so that every worker writes whole pages. */
+    fft_workerrange( n1, worker, num_workers, &j0, &j1 );
+    for ( j = j0; j < j1; j++ ) {
+	spectrum_t *d = job->x + 2*((size_t)j*n2 + job->start);
+	for ( c = 0; c < job->count; c++ ) {
+	    d[2*c] = job->panel[2*((size_t)c*n1 + j)];
+	    d[2*c+1] = job->panel[2*((size_t)c*n1 + j) + 1];
+	}
+    }
+}
+
+/* Step 2: transforms the rows start..start+count-1. */
+static void cfft_ooc_rows_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_ooc_job *job = arg;
+  int n2 = job->n2;
+  int r0,r1,r;
+
+    fft_workerrange( job->count, worker, num_workers, &r0, &r1 );
+    for ( r = r0; r < r1; r++ ) {
+	spectrum_t *p = job->panel + 2*(size_t)r*n2;
+	memcpy( p, job->x + 2*((size_t)(job->start + r)*n2), 2*sizeof(spectrum_t)*n2 );
+	cfft_transform( p, n2, job->forward, job->tw2, 1., 1, NULL, n2, false );
+    }
+}
+
+static void cfft_ooc_rows_store_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_ooc_job *job = arg;
+  int n1 = job->n1, n2 = job->n2;
+  int k0,k1,k2,r;
+
+    fft_workerrange( n2, worker, num_workers, &k0, &k1 );
+    for ( k2 = k0; k2 < k1; k2++ ) {
+	spectrum_t *d = job->out + 2*((size_t)k2*n1 + job->start);
+	for ( r = 0; r < job->count; r++ ) {
+	    d[2*r] = job->panel[2*((size_t)r*n2 + k2)];
+	    d[2*r+1] = job->panel[2*((size_t)r*n2 + k2) + 1];
+	}
+    }
+}
+
+/* Step 3. */
+static void cfft_ooc_copy_job(void *arg, int worker, int num_workers)
+{
+  struct cfft_ooc_job *job = arg;
+  int i0,i1;
+
+    fft_workerrange( job->NC, worker, num_workers, &i0, &i1 );
+    if ( i0 < i1 )
+	memcpy( job->x + 2*(size_t)i0, job->out + 2*(size_t)i0, 2*sizeof(spectrum_t)*(i1-i0) );
+}
+
+/* Returns false if the memory for the panel or the temporary file could
+   not be allocated, in which case x is left untouched. */
+static bool cfft_ooc(spectrum_t x[], int NC, int forward, spectrum_t scale, int *progval)
+{
+  struct cfft_ooc_job job;
+  int 		num_workers = WORKERS_getNum();
+  int 		panelsize,
+		perpanel;
+
+    job.x = x;
+    job.NC = NC;
+    /* n1 <= n2, as close to sqrt(NC) as the factors allow. */
+    for ( job.n1 = (int)sqrt( (double)NC ); NC % job.n1 != 0; job.n1-- )
+	;
+    job.n2 = NC / job.n1;
+    job.forward = forward;
+    job.scale = scale;
+
+    /* At least one row or column must fit. (n2 >= n1) */
+    panelsize = mammut_max( FFT_OOC_PANEL, job.n2 );
+    job.panel = malloc( 2*sizeof(spectrum_t)*(size_t)panelsize );
+    if ( job.panel == NULL )
+	return false;
+    job.out = BIGMEM_allocOnDisk( 2*(size_t)NC );
+    if ( job.out == NULL ) {
+	free( job.panel );
+	return false;
+    }
+
+    /* Made here, once, instead of in every worker. */
+    job.tw = twiddles_get( NC );
+    job.tw1 = twiddles_get( job.n1 );
+    job.tw2 = twiddles_get( job.n2 );
+
+    perpanel = mammut_min( job.n2, panelsize/job.n1 );
+    for ( job.start = 0; job.start < job.n2; job.start += job.count ) {
+	job.count = mammut_min( perpanel, job.n2 - job.start );
+	WORKERS_run( cfft_ooc_columns_job, &job, num_workers );
+	WORKERS_run( cfft_ooc_columns_store_job, &job, num_workers );
+	*progval = 100 * job.start / job.n2;
+    }
+
+    perpanel = mammut_min( job.n1, panelsize/job.n2 );
+    for ( job.start = 0; job.start < job.n1; job.start += job.count ) {
+	job.count = mammut_min( perpanel, job.n1 - job.start );
+	WORKERS_run( cfft_ooc_rows_job, &job, num_workers );
+	WORKERS_run( cfft_ooc_rows_store_job, &job, num_workers );
+	*progval = 100 + 100 * job.start / job.n1;
+    }
+
+    WORKERS_run( cfft_ooc_copy_job, &job, num_workers );
+
+    BIGMEM_free( job.out );
+    free( job.panel );
+    return true;
+}
+
+#ifdef FFT_OOC_CHECK
+/* Compiling with -DFFT_OOC_CHECK makes cfft do the normal transform of a
+   copy of x in memory as well, and print the largest difference between
+   that and the output of cfft_ooc. With a small FFT_OOC_PANEL (and
+   FFT_OOC_MIN), sizes like 20412000 = 4500 x 4536 check the last panels,
+   which do not divide the rows and columns evenly. */
+static spectrum_t *cfft_ooc_checkbegin(const spectrum_t x[], int NC)
+{
+  spectrum_t *in = malloc( 2*sizeof(spectrum_t)*(size_t)NC );
+
+    if ( in != NULL )
+	memcpy( in, x, 2*sizeof(spectrum_t)*(size_t)NC );
+    return in;
+}
+
+static void cfft_ooc_checkend(spectrum_t *in, const spectrum_t x[], int NC, int forward, spectrum_t scale)
+{
+  double 	diff = 0,
+		max = 0;
+  size_t 	i;
+
+    if ( in == NULL )
+	return;
+    cfft_transform( in, NC, forward, twiddles_get( NC ), scale, fft_num_workers(NC), NULL, NC, false );
+    for ( i = 0; i < 2*(size_t)NC; i++ ) {
+	diff = mammut_max( diff, fabs( in[i] - x[i] ) );
+	max = mammut_max( max, fabs( in[i] ) );
+    }
+    fprintf(stderr,"cfft_ooc: NC=%d, largest difference %g, largest value %g\n",NC,diff,max);
+    free( in );
+}
+#endif
+
+
+
+/* cfft replaces array x containing NC complex values
+   (2*NC values alternating real, imagininary, etc.)
    by its Fourier transform if forward is true, or by its
-   inverse Fourier transform if forward is false, using a
-   recursive Fast Fourier transform method due to Danielson
-   and Lanczos.  NC MUST be a power of 2. */
+   inverse Fourier transform if forward is false, using an
+   iterative radix-4 Fast Fourier transform for powers of 2, the
+   mixed radix transform for sizes with the factors 2, 3, 5 and 7,
+   and Bluestein's algorithm for the rest. Only the first nonzero
+   complex values of x can be nonzero, and if inorder is true, they have
+   been put in the order of fft_inputorder. */
 
-static void cfft( x, NC, forward )
-float x[]; int NC, forward;
+/* True if cfft uses cfft_ooc for x. */
+static bool cfft_useooc(const spectrum_t x[], int NC)
 {
-  float 	wr,wi,
-		wpr,wpi,
-		theta,
-		scale;
-  int 		mmax,
-		ND,
-		m,
-		i,j,
-		delta;
-  int logND;
+    return NC >= FFT_OOC_MIN && BIGMEM_isOnDisk(x);
+}
 
+static void cfft( x, NC, forward, nonzero, inorder )
+spectrum_t x[]; int NC, forward, nonzero; bool inorder;
+{
+  spectrum_t scale = forward ? 0.5/NC : 2.;
 
   int_progval();
 
+    if ( cfft_useooc( x, NC ) ) {
+#ifdef FFT_OOC_CHECK
+	spectrum_t *in = cfft_ooc_checkbegin( x, NC );
+#endif
+	GUI_startprogressbar(0,progval,200);
+	if ( cfft_ooc( x, NC, forward, scale, progval ) ) {
+	    GUI_stopprogressbar();
+#ifdef FFT_OOC_CHECK
+	    cfft_ooc_checkend( in, x, NC, forward, scale );
+#endif
+	    return;
+	}
+	GUI_stopprogressbar();
+#ifdef FFT_OOC_CHECK
+	free( in );
+#endif
+	fprintf(stderr,"Not enough memory for the out-of-core fft. Using the normal one.\n");
+    }
+
+    GUI_startprogressbar(0,progval,log(NC*4)*100);
+    cfft_transform( x, NC, forward, twiddles_get( NC ), scale, fft_num_workers(NC), progval, nonzero, inorder );
+    GUI_stopprogressbar();
+}
+
+
+
+/* INPUT ORDER */
 
-    ND = NC<<1;
-    logND=log(ND);
+/* The order cfft wants its input in, for writing the values of the sound
+   straight into place when loading (see readsound). Value 2*n and 2*n+1
+   of the sound (complex value n) goes to the position returned by the
+   n'th call to fft_inputorder_next.
 
-    GUI_startprogressbar(0,progval,log(ND*2)*100);
-    //GUI_startprogressbar(2,&progval,ND);
+   Writing the values to their digit-reversed positions costs one random
+   write for every value. That is only cheaper than the cycle following
+   of cfft_digitreverse over the whole array, ie. for mixed radix sizes
+   where no stages are pruned away. The tiled bit reversal of the power
+   of two sizes and the digit reversal of pruned transforms (which only
+   covers the start of the array) are faster than the random writes, so
+   all other transforms get the values in their natural order. */
 
-    bitreverse( x, ND );
+static bool fft_inputorder_used(const spectrum_t x[], int NC, int nonzero)
+{
+  struct fft_factors 	fac,
+			rest;
+
+    return (NC & (NC-1)) != 0
+	&& cfft_useooc( x, NC ) == false
+	&& fft_factorize( NC, &fac )
+	&& fft_prune( NC, nonzero, &fac, &rest ) == 1;
+}
+
+void fft_inputorder_init(struct fft_inputorder *o, const spectrum_t x[], int N, int nonzero)
+{
+  struct fft_factors 	fac;
+  int 		weight,
+		i;
+
+    o->num = 0;
+    o->pos = 0;
+    if ( fft_inputorder_used( x, N, (mammut_min( nonzero, 2*N )+1)/2 ) == false )
+	return;
+
+    fft_factorize( N, &fac );
+    o->num = fac.num;
+    for ( i = 0, weight = 1; i < fac.num; weight *= fac.f[i], i++ ) {
+	o->f[i] = fac.f[i];
+	o->weight[i] = weight;
+	o->digit[i] = 0;
+    }
+}
+
+/* The position of a digit value d. The radix-4 digits are bit-reversed. */
+static int fft_inputorder_digit(int f, int d)
+{
+    return f == 4 ? ((d&1)<<1) | (d>>1) : d;
+}
 
-    printf("About top do something\n");
-    for ( mmax = 2; mmax < ND; mmax = delta ) {
-      //        XtVaSetValues(progressScale, XmNvalue, 100*mmax/ND, NULL);
-      *progval=log(mmax*2)*100;
-      //progval=mmax;
+int fft_inputorder_next(struct fft_inputorder *o)
+{
+  int 		pos = o->pos,
+		i,d;
 
-      //printf("About top do something %d / %d / %d\n",0,progval,ND);
-      //printf("About top do something %d / %d / %d\n",0,progval,(int)log(ND*2)*100);
-      //GUI_progressbar(0,log(mmax*2),logND);
+    if ( o->num == 0 ) {
+	o->pos++;
+	return pos;
+    }
 
-	delta = mmax<<1;
-	theta = TWOPI/( forward? mmax : -mmax );
-	wpr = -2.*powf( sinf( 0.5*theta ), 2. );
-	wpi = sinf( theta );
-	wr = 1.;
-	wi = 0.;
-	for ( m = 0; m < mmax; m += 2 ) {
-	  register float rtemp, itemp;
-	  for ( i = m; i < ND; i += delta ) {
-	    j = i + mmax;
-	    rtemp = wr*x[j] - wi*x[j+1];
-	    itemp = wr*x[j+1] + wi*x[j];
-	    x[j] = x[i] - rtemp;
-	    x[j+1] = x[i+1] - itemp;
-	    x[i] += rtemp;
-	    x[i+1] += itemp;
-	  }
-	  wr = (rtemp = wr)*wpr - wi*wpi + wr;
-	  wi = wi*wpr + rtemp*wpi + wi;
+    /* The lowest digit of n is the highest digit of the position. */
+    for ( i = o->num-1; i >= 0; i-- ) {
+	d = o->digit[i];
+	o->pos -= o->weight[i]*fft_inputorder_digit( o->f[i], d );
+	if ( d+1 < o->f[i] ) {
+	    o->digit[i] = d+1;
+	    o->pos += o->weight[i]*fft_inputorder_digit( o->f[i], d+1 );
+	    break;
 	}
+	o->digit[i] = 0;
     }
+    return pos;
+}
 
-/* scale output */
+/* Sets o so that the next call to fft_inputorder_next returns the
+   position of complex value n. */
+void fft_inputorder_seek(struct fft_inputorder *o, int n)
+{
+  int 		i;
 
-    scale = forward ? 1./ND : 2.;
-    { register float *xi=x, *xe=x+ND;
-	while ( xi < xe )
-	    *xi++ *= scale;
+    if ( o->num == 0 ) {
+	o->pos = n;
+	return;
     }
 
-    GUI_stopprogressbar();
+    o->pos = 0;
+    for ( i = o->num-1; i >= 0; i-- ) {
+	o->digit[i] = n % o->f[i];
+	n /= o->f[i];
+	o->pos += o->weight[i]*fft_inputorder_digit( o->f[i], o->digit[i] );
+    }
 }
 
-/* bitreverse places float array x containing N/2 complex values
+
+
+/* bitreverse places array x containing N/2 complex values
    into bit-reversed order */
 
-void bitreverse(float x[], int N)
+void bitreverse(spectrum_t x[], int N)
+{
+    bitreverse_range( x, N, 0, N );
+}
+
+/* Does the complex exchanges of bitreverse for the indexes
+   i0 <= i < i1. Every exchange is done by the range containing the
+   lowest of the two indexes, so disjoint ranges can run in parallel. */
+
+static void bitreverse_range(spectrum_t x[], int N, int i0, int i1)
 {
-  float 	rtemp,itemp;
+  spectrum_t 	rtemp,itemp;
   int 		i,j,
-		m;
+		m,c;
+
+    /* j = i0 bit-reversed */
+    for ( j = 0, m = N>>2, c = i0>>1; c > 0; m >>= 1, c >>= 1 )
+	if ( c & 1 )
+	    j += m;
+    j <<= 1;
 
-    for ( i = j = 0; i < N; i += 2, j += m ) {
+    for ( i = i0; i < i1; i += 2, j += m ) {
 	if ( j > i ) {
 	    rtemp = x[j]; itemp = x[j+1]; /* complex exchange */
 	    x[j] = x[i]; x[j+1] = x[i+1];
@@ -177,3 +1525,67 @@ void bitreverse(float x[], int N)
 	    j -= m;
     }
 }
+
+/* Bit reversal in cache sized tiles (the COBRA method). With q =
+   FFT_COBRA_BITS, the index is split in its q highest bits a, the q
+   lowest bits c, and the bits b between. Index (a,b,c) goes to
+   (rev(c),rev(b),rev(a)), so all the values with the same b come from
+   2^q runs of 2^q contiguous values, and go to 2^q other such runs. The
+   runs are read into a tile with row rev(a), and written out column by
+   column, which accesses the memory in whole cache lines instead of
+   jumping around in the whole array for every value.
+
+   The tiles for b and rev(b) are exchanged by the call with the lowest
+   of the two between b0 and b1. NC must be a power of two of at least
+   2^(2*q). */
+
+static void bitreverse_tiles(spectrum_t x[], int NC, int b0, int b1)
+{
+  spectrum_t 	tile[2][2*FFT_COBRA_TILE*FFT_COBRA_TILE];
+  int 		rev[FFT_COBRA_TILE];
+  int 		nb,rb,
+		stride = NC/FFT_COBRA_TILE,
+		a,b,c,i,t,
+		ntiles;
+  int 		from[2];
+  spectrum_t 	*src,*dst;
+
+    for ( nb = 0; (FFT_COBRA_TILE*FFT_COBRA_TILE)<<nb < NC; nb++ )
+	;
+
+    for ( a = 0; a < FFT_COBRA_TILE; a++ )
+	for ( rev[a] = 0, i = 0; i < FFT_COBRA_BITS; i++ )
+	    if ( a & (1<<i) )
+		rev[a] |= 1<<(FFT_COBRA_BITS-1-i);
+
+    for ( b = b0; b < b1; b++ ) {
+	for ( rb = 0, i = 0; i < nb; i++ )
+	    if ( b & (1<<i) )
+		rb |= 1<<(nb-1-i);
+	if ( rb < b )
+	    continue;
+
+	from[0] = b;
+	from[1] = rb;
+	ntiles = rb == b ? 1 : 2;
+
+	for ( t = 0; t < ntiles; t++ )
+	    for ( a = 0; a < FFT_COBRA_TILE; a++ ) {
+		src = x + 2*((size_t)a*stride + (size_t)from[t]*FFT_COBRA_TILE);
+		dst = tile[t] + 2*rev[a]*FFT_COBRA_TILE;
+		for ( c = 0; c < 2*FFT_COBRA_TILE; c++ )
+		    dst[c] = src[c];
+	    }
+
+	/* Tile t goes to the tile of from[1-t]. */
+	for ( t = 0; t < ntiles; t++ )
+	    for ( c = 0; c < FFT_COBRA_TILE; c++ ) {
+		src = tile[t] + 2*c;
+		dst = x + 2*((size_t)rev[c]*stride + (size_t)from[ntiles-1-t]*FFT_COBRA_TILE);
+		for ( a = 0; a < FFT_COBRA_TILE; a++ ) {
+		    dst[2*a] = src[2*a*FFT_COBRA_TILE];
+		    dst[2*a+1] = src[2*a*FFT_COBRA_TILE+1];
+		}
+	    }
+    }
+}
@@ -0,0 +1,487 @@
+#include "mammut.h"
+#include "fft_simd.h"
+
+
+/* SIMD FFT KERNELS */
+
+/* Each function is compiled for its own instruction set with the target
+   attribute, so the rest of the program can still run on any x86 cpu.
+   fft.c picks the widest set the cpu has when mammut starts (fft_init).
+
+   The data is kept interleaved (re,im,re,im...), so a vector holds 2 (SSE2),
+   4 (AVX2) or 8 (AVX-512) complex values. See fft_simd.h for the layout of
+   the twiddle buffers, and radix4_butterflies and rfft_split_butterflies in
+   fft.c for what is calculated. */
+
+#ifdef FFT_SIMD
+
+#include <immintrin.h>
+
+
+int fft_simd_level(void)
+{
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx512f") )
+	return FFT_SIMD_AVX512;
+    if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") )
+	return FFT_SIMD_AVX2;
+    if ( __builtin_cpu_supports("sse2") )
+	return FFT_SIMD_SSE2;
+    return FFT_SIMD_NONE;
+}
+
+
+
+/* SSE2 */
+
+#define SSE2 __attribute__((target("sse2")))
+
+/* (re,im) -> (im,re) */
+static inline SSE2 __m128 swap_sse2(__m128 v)
+{
+    return _mm_shuffle_ps( v, v, _MM_SHUFFLE(2,3,0,1) );
+}
+
+/* Reverses the order of the complex values. */
+static inline SSE2 __m128 reverse_sse2(__m128 v)
+{
+    return _mm_shuffle_ps( v, v, _MM_SHUFFLE(1,0,3,2) );
+}
+
+static inline SSE2 __m128 cmul_sse2(__m128 v, const float *t, int tn)
+{
+    return _mm_add_ps( _mm_mul_ps( v, _mm_loadu_ps(t) ),
+		       _mm_mul_ps( swap_sse2(v), _mm_loadu_ps(t + 2*tn) ) );
+}
+
+SSE2 int radix4_butterflies_sse2(float x[], int L, int n, const float tw[], int tn, int forward, float scale)
+{
+  float 	*x1 = x + 2*L, *x2 = x + 4*L, *x3 = x + 6*L;
+  __m128 	vscale = _mm_set1_ps( scale ),
+		jsign = forward ? _mm_setr_ps(-1,1,-1,1) : _mm_setr_ps(1,-1,1,-1),
+		a,c,d,e, s0,s1,s2,s3;
+  int 		k, done = n & ~1;
+
+    for ( k = 0; k < done+done; k += 4 ) {
+	a = _mm_mul_ps( vscale, _mm_loadu_ps(x+k) );
+	c = cmul_sse2( _mm_loadu_ps(x1+k), tw + k, tn );
+	d = cmul_sse2( _mm_loadu_ps(x2+k), tw + 4*tn + k, tn );
+	e = cmul_sse2( _mm_loadu_ps(x3+k), tw + 8*tn + k, tn );
+
+	s0 = _mm_add_ps( a, c );
+	s1 = _mm_sub_ps( a, c );
+	s2 = _mm_add_ps( d, e );
+	s3 = _mm_mul_ps( swap_sse2( _mm_sub_ps(d,e) ), jsign );
+
+	_mm_storeu_ps( x+k, _mm_add_ps(s0,s2) );
+	_mm_storeu_ps( x2+k, _mm_sub_ps(s0,s2) );
+	_mm_storeu_ps( x1+k, _mm_add_ps(s1,s3) );
+	_mm_storeu_ps( x3+k, _mm_sub_ps(s1,s3) );
+    }
+    return done;
+}
+
+SSE2 int rfft_split_sse2(float x[], int N, int i, int n, const float tw[], int tn, int forward)
+{
+  __m128 	half = _mm_set1_ps( 0.5f ),
+		conj = _mm_setr_ps(1,-1,1,-1),
+		jsign = forward ? _mm_setr_ps(1,-1,1,-1) : _mm_setr_ps(-1,1,-1,1),
+		a,b,h1,h2;
+  float 	*xb;
+  int 		k;
+
+    for ( k = 0; k+2 <= n && 2*(i+k+1) < N; k += 2 ) {
+	xb = x + 2*(N-i-k-1);
+	a = _mm_loadu_ps( x + 2*(i+k) );
+	b = _mm_mul_ps( reverse_sse2( _mm_loadu_ps(xb) ), conj );
+	h1 = _mm_mul_ps( half, _mm_add_ps(a,b) );
+	h2 = _mm_mul_ps( half, _mm_mul_ps( swap_sse2( _mm_sub_ps(a,b) ), jsign ) );
+	h2 = cmul_sse2( h2, tw + 2*k, tn );
+	_mm_storeu_ps( x + 2*(i+k), _mm_add_ps(h1,h2) );
+	_mm_storeu_ps( xb, reverse_sse2( _mm_mul_ps( _mm_sub_ps(h1,h2), conj ) ) );
+    }
+    return k;
+}
+
+
+
+/* AVX2 (with FMA) */
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+static inline AVX2 __m256 swap_avx2(__m256 v)
+{
+    return _mm256_permute_ps( v, _MM_SHUFFLE(2,3,0,1) );
+}
+
+static inline AVX2 __m256 reverse_avx2(__m256 v)
+{
+    v = _mm256_permute2f128_ps( v, v, 1 );
+    return _mm256_permute_ps( v, _MM_SHUFFLE(1,0,3,2) );
+}
+
+static inline AVX2 __m256 cmul_avx2(__m256 v, const float *t, int tn)
+{
+    return _mm256_fmadd_ps( v, _mm256_loadu_ps(t),
+			    _mm256_mul_ps( swap_avx2(v), _mm256_loadu_ps(t + 2*tn) ) );
+}
+
+AVX2 int radix4_butterflies_avx2(float x[], int L, int n, const float tw[], int tn, int forward, float scale)
+{
+  float 	*x1 = x + 2*L, *x2 = x + 4*L, *x3 = x + 6*L;
+  __m256 	vscale = _mm256_set1_ps( scale ),
+		jsign = forward ? _mm256_setr_ps(-1,1,-1,1,-1,1,-1,1) : _mm256_setr_ps(1,-1,1,-1,1,-1,1,-1),
+		a,c,d,e, s0,s1,s2,s3;
+  int 		k, done = n & ~3;
+
+    for ( k = 0; k < done+done; k += 8 ) {
+	a = _mm256_mul_ps( vscale, _mm256_loadu_ps(x+k) );
+	c = cmul_avx2( _mm256_loadu_ps(x1+k), tw + k, tn );
+	d = cmul_avx2( _mm256_loadu_ps(x2+k), tw + 4*tn + k, tn );
+	e = cmul_avx2( _mm256_loadu_ps(x3+k), tw + 8*tn + k, tn );
+
+	s0 = _mm256_add_ps( a, c );
+	s1 = _mm256_sub_ps( a, c );
+	s2 = _mm256_add_ps( d, e );
+	s3 = _mm256_mul_ps( swap_avx2( _mm256_sub_ps(d,e) ), jsign );
+
+	_mm256_storeu_ps( x+k, _mm256_add_ps(s0,s2) );
+	_mm256_storeu_ps( x2+k, _mm256_sub_ps(s0,s2) );
+	_mm256_storeu_ps( x1+k, _mm256_add_ps(s1,s3) );
+	_mm256_storeu_ps( x3+k, _mm256_sub_ps(s1,s3) );
+    }
+    return done;
+}
+
+AVX2 int rfft_split_avx2(float x[], int N, int i, int n, const float tw[], int tn, int forward)
+{
+  __m256 	half = _mm256_set1_ps( 0.5f ),
+		conj = _mm256_setr_ps(1,-1,1,-1,1,-1,1,-1),
+		jsign = forward ? _mm256_setr_ps(1,-1,1,-1,1,-1,1,-1) : _mm256_setr_ps(-1,1,-1,1,-1,1,-1,1),
+		a,b,h1,h2;
+  float 	*xb;
+  int 		k;
+
+    for ( k = 0; k+4 <= n && 2*(i+k+3) < N; k += 4 ) {
+	xb = x + 2*(N-i-k-3);
+	a = _mm256_loadu_ps( x + 2*(i+k) );
+	b = _mm256_mul_ps( reverse_avx2( _mm256_loadu_ps(xb) ), conj );
+	h1 = _mm256_mul_ps( half, _mm256_add_ps(a,b) );
+	h2 = _mm256_mul_ps( half, _mm256_mul_ps( swap_avx2( _mm256_sub_ps(a,b) ), jsign ) );
+	h2 = cmul_avx2( h2, tw + 2*k, tn );
+	_mm256_storeu_ps( x + 2*(i+k), _mm256_add_ps(h1,h2) );
+	_mm256_storeu_ps( xb, reverse_avx2( _mm256_mul_ps( _mm256_sub_ps(h1,h2), conj ) ) );
+    }
+    return k;
+}
+
+
+
+/* AVX-512 */
+
+#define AVX512 __attribute__((target("avx512f")))
+
+static inline AVX512 __m512 swap_avx512(__m512 v)
+{
+    return _mm512_permute_ps( v, _MM_SHUFFLE(2,3,0,1) );
+}
+
+static inline AVX512 __m512 reverse_avx512(__m512 v)
+{
+    return _mm512_permutexvar_ps( _mm512_setr_epi32(14,15,12,13,10,11,8,9,6,7,4,5,2,3,0,1), v );
+}
+
+static inline AVX512 __m512 cmul_avx512(__m512 v, const float *t, int tn)
+{
+    return _mm512_fmadd_ps( v, _mm512_loadu_ps(t),
+			    _mm512_mul_ps( swap_avx512(v), _mm512_loadu_ps(t + 2*tn) ) );
+}
+
+static inline AVX512 __m512 altsign_avx512(float even, float odd)
+{
+    return _mm512_setr_ps( even,odd,even,odd,even,odd,even,odd,
+			   even,odd,even,odd,even,odd,even,odd );
+}
+
+AVX512 int radix4_butterflies_avx512(float x[], int L, int n, const float tw[], int tn, int forward, float scale)
+{
+  float 	*x1 = x + 2*L, *x2 = x + 4*L, *x3 = x + 6*L;
+  __m512 	vscale = _mm512_set1_ps( scale ),
+		jsign = forward ? altsign_avx512(-1,1) : altsign_avx512(1,-1),
+		a,c,d,e, s0,s1,s2,s3;
+  int 		k, done = n & ~7;
+
+    for ( k = 0; k < done+done; k += 16 ) {
+	a = _mm512_mul_ps( vscale, _mm512_loadu_ps(x+k) );
+	c = cmul_avx512( _mm512_loadu_ps(x1+k), tw + k, tn );
+	d = cmul_avx512( _mm512_loadu_ps(x2+k), tw + 4*tn + k, tn );
+	e = cmul_avx512( _mm512_loadu_ps(x3+k), tw + 8*tn + k, tn );
+
+	s0 = _mm512_add_ps( a, c );
+	s1 = _mm512_sub_ps( a, c );
+	s2 = _mm512_add_ps( d, e );
+	s3 = _mm512_mul_ps( swap_avx512( _mm512_sub_ps(d,e) ), jsign );
+
+	_mm512_storeu_ps( x+k, _mm512_add_ps(s0,s2) );
+	_mm512_storeu_ps( x2+k, _mm512_sub_ps(s0,s2) );
+	_mm512_storeu_ps( x1+k, _mm512_add_ps(s1,s3) );
+	_mm512_storeu_ps( x3+k, _mm512_sub_ps(s1,s3) );
+    }
+    return done;
+}
+
+AVX512 int rfft_split_avx512(float x[], int N, int i, int n, const float tw[], int tn, int forward)
+{
+  __m512 	half = _mm512_set1_ps( 0.5f ),
+		conj = altsign_avx512(1,-1),
+		jsign = forward ? altsign_avx512(1,-1) : altsign_avx512(-1,1),
+		a,b,h1,h2;
+  float 	*xb;
+  int 		k;
+
+    for ( k = 0; k+8 <= n && 2*(i+k+7) < N; k += 8 ) {
+	xb = x + 2*(N-i-k-7);
+	a = _mm512_loadu_ps( x + 2*(i+k) );
+	b = _mm512_mul_ps( reverse_avx512( _mm512_loadu_ps(xb) ), conj );
+	h1 = _mm512_mul_ps( half, _mm512_add_ps(a,b) );
+	h2 = _mm512_mul_ps( half, _mm512_mul_ps( swap_avx512( _mm512_sub_ps(a,b) ), jsign ) );
+	h2 = cmul_avx512( h2, tw + 2*k, tn );
+	_mm512_storeu_ps( x + 2*(i+k), _mm512_add_ps(h1,h2) );
+	_mm512_storeu_ps( xb, reverse_avx512( _mm512_mul_ps( _mm512_sub_ps(h1,h2), conj ) ) );
+    }
+    return k;
+}
+
+
+
+
+/* MULTIPLY KERNELS */
+
+/* For Load & Multiply. a is the loaded sound and b the partner, and the
+   result goes into a. Two loads and one store for every complex value,
+   so these are limited by the memory, not the cpu. */
+
+/* SSE2 */
+
+static inline SSE2 __m128 dupreal_sse2(__m128 v)
+{
+    return _mm_shuffle_ps( v, v, _MM_SHUFFLE(2,2,0,0) );
+}
+
+static inline SSE2 __m128 dupimag_sse2(__m128 v)
+{
+    return _mm_shuffle_ps( v, v, _MM_SHUFFLE(3,3,1,1) );
+}
+
+/* (|v|,|v|) */
+static inline SSE2 __m128 abs_sse2(__m128 v)
+{
+    v = _mm_mul_ps( v, v );
+    return _mm_sqrt_ps( _mm_add_ps( v, swap_sse2(v) ) );
+}
+
+/* a*b, or a*conj(b) with the opposite sign. */
+static inline SSE2 __m128 cmulsign_sse2(__m128 a, __m128 b, __m128 sign)
+{
+    return _mm_add_ps( _mm_mul_ps( a, dupreal_sse2(b) ),
+		       _mm_mul_ps( _mm_mul_ps( swap_sse2(a), dupimag_sse2(b) ), sign ) );
+}
+
+static SSE2 int multiply_sign_sse2(float a[], const float b[], int n, float scale, __m128 sign)
+{
+  __m128 	vscale = _mm_set1_ps( scale );
+  int 		k, done = n & ~1;
+
+    for ( k = 0; k < done+done; k += 4 )
+	_mm_storeu_ps( a+k, _mm_mul_ps( vscale, cmulsign_sse2( _mm_loadu_ps(a+k), _mm_loadu_ps(b+k), sign ) ) );
+    return done;
+}
+
+SSE2 int multiply_convolve_sse2(float a[], const float b[], int n, float scale)
+{
+    return multiply_sign_sse2( a, b, n, scale, _mm_setr_ps(-1,1,-1,1) );
+}
+
+SSE2 int multiply_correlate_sse2(float a[], const float b[], int n, float scale)
+{
+    return multiply_sign_sse2( a, b, n, scale, _mm_setr_ps(1,-1,1,-1) );
+}
+
+/* (r1*r2-i1*r1, i1*r2+r1*i2) */
+SSE2 int multiply_fun_sse2(float a[], const float b[], int n, float scale)
+{
+  __m128 	vscale = _mm_set1_ps( scale ),
+		sign = _mm_setr_ps(-1,1,-1,1),
+		realmask = _mm_castsi128_ps( _mm_setr_epi32(-1,0,-1,0) ),
+		va,vb,c;
+  int 		k, done = n & ~1;
+
+    for ( k = 0; k < done+done; k += 4 ) {
+	va = _mm_loadu_ps( a+k );
+	vb = _mm_loadu_ps( b+k );
+	c = _mm_or_ps( _mm_and_ps( realmask, va ), _mm_andnot_ps( realmask, vb ) ); /* (r1,i2) */
+	c = _mm_add_ps( _mm_mul_ps( va, dupreal_sse2(vb) ), _mm_mul_ps( _mm_mul_ps( swap_sse2(va), c ), sign ) );
+	_mm_storeu_ps( a+k, _mm_mul_ps( vscale, c ) );
+    }
+    return done;
+}
+
+/* b*|a|/|b|, or (|a|,0) where b is 0. */
+SSE2 int multiply_phase_amp_sse2(float a[], const float b[], int n, float scale)
+{
+  __m128 	realmask = _mm_castsi128_ps( _mm_setr_epi32(-1,0,-1,0) ),
+		vb,amp,bamp,zero;
+  int 		k, done = n & ~1;
+
+    for ( k = 0; k < done+done; k += 4 ) {
+	vb = _mm_loadu_ps( b+k );
+	amp = abs_sse2( _mm_loadu_ps(a+k) );
+	bamp = abs_sse2( vb );
+	zero = _mm_cmpeq_ps( bamp, _mm_setzero_ps() );
+	_mm_storeu_ps( a+k, _mm_or_ps( _mm_and_ps( zero, _mm_and_ps( realmask, amp ) ),
+				       _mm_andnot_ps( zero, _mm_mul_ps( vb, _mm_div_ps( amp, bamp ) ) ) ) );
+    }
+    return done;
+}
+
+
+
+/* AVX2 */
+
+static inline AVX2 __m256 abs_avx2(__m256 v)
+{
+    v = _mm256_mul_ps( v, v );
+    return _mm256_sqrt_ps( _mm256_add_ps( v, swap_avx2(v) ) );
+}
+
+static AVX2 int multiply_sign_avx2(float a[], const float b[], int n, float scale, __m256 sign)
+{
+  __m256 	vscale = _mm256_set1_ps( scale ),
+		va,vb;
+  int 		k, done = n & ~3;
+
+    for ( k = 0; k < done+done; k += 8 ) {
+	va = _mm256_loadu_ps( a+k );
+	vb = _mm256_loadu_ps( b+k );
+	va = _mm256_fmadd_ps( va, _mm256_moveldup_ps(vb),
+			      _mm256_mul_ps( _mm256_mul_ps( swap_avx2(va), _mm256_movehdup_ps(vb) ), sign ) );
+	_mm256_storeu_ps( a+k, _mm256_mul_ps( vscale, va ) );
+    }
+    return done;
+}
+
+AVX2 int multiply_convolve_avx2(float a[], const float b[], int n, float scale)
+{
+    return multiply_sign_avx2( a, b, n, scale, _mm256_setr_ps(-1,1,-1,1,-1,1,-1,1) );
+}
+
+AVX2 int multiply_correlate_avx2(float a[], const float b[], int n, float scale)
+{
+    return multiply_sign_avx2( a, b, n, scale, _mm256_setr_ps(1,-1,1,-1,1,-1,1,-1) );
+}
+
+AVX2 int multiply_fun_avx2(float a[], const float b[], int n, float scale)
+{
+  __m256 	vscale = _mm256_set1_ps( scale ),
+		sign = _mm256_setr_ps(-1,1,-1,1,-1,1,-1,1),
+		va,vb,c;
+  int 		k, done = n & ~3;
+
+    for ( k = 0; k < done+done; k += 8 ) {
+	va = _mm256_loadu_ps( a+k );
+	vb = _mm256_loadu_ps( b+k );
+	c = _mm256_blend_ps( va, vb, 0xaa ); /* (r1,i2) */
+	c = _mm256_fmadd_ps( va, _mm256_moveldup_ps(vb), _mm256_mul_ps( _mm256_mul_ps( swap_avx2(va), c ), sign ) );
+	_mm256_storeu_ps( a+k, _mm256_mul_ps( vscale, c ) );
+    }
+    return done;
+}
+
+AVX2 int multiply_phase_amp_avx2(float a[], const float b[], int n, float scale)
+{
+  __m256 	vb,amp,bamp,zero;
+  int 		k, done = n & ~3;
+
+    for ( k = 0; k < done+done; k += 8 ) {
+	vb = _mm256_loadu_ps( b+k );
+	amp = abs_avx2( _mm256_loadu_ps(a+k) );
+	bamp = abs_avx2( vb );
+	zero = _mm256_cmp_ps( bamp, _mm256_setzero_ps(), _CMP_EQ_OQ );
+	_mm256_storeu_ps( a+k, _mm256_blendv_ps( _mm256_mul_ps( vb, _mm256_div_ps( amp, bamp ) ),
+						 _mm256_blend_ps( amp, _mm256_setzero_ps(), 0xaa ),
+						 zero ) );
+    }
+    return done;
+}
+
+
+
+/* AVX-512 */
+
+static inline AVX512 __m512 abs_avx512(__m512 v)
+{
+    v = _mm512_mul_ps( v, v );
+    return _mm512_sqrt_ps( _mm512_add_ps( v, swap_avx512(v) ) );
+}
+
+static AVX512 int multiply_sign_avx512(float a[], const float b[], int n, float scale, __m512 sign)
+{
+  __m512 	vscale = _mm512_set1_ps( scale ),
+		va,vb;
+  int 		k, done = n & ~7;
+
+    for ( k = 0; k < done+done; k += 16 ) {
+	va = _mm512_loadu_ps( a+k );
+	vb = _mm512_loadu_ps( b+k );
+	va = _mm512_fmadd_ps( va, _mm512_moveldup_ps(vb),
+			      _mm512_mul_ps( _mm512_mul_ps( swap_avx512(va), _mm512_movehdup_ps(vb) ), sign ) );
+	_mm512_storeu_ps( a+k, _mm512_mul_ps( vscale, va ) );
+    }
+    return done;
+}
+
+AVX512 int multiply_convolve_avx512(float a[], const float b[], int n, float scale)
+{
+    return multiply_sign_avx512( a, b, n, scale, altsign_avx512(-1,1) );
+}
+
+AVX512 int multiply_correlate_avx512(float a[], const float b[], int n, float scale)
+{
+    return multiply_sign_avx512( a, b, n, scale, altsign_avx512(1,-1) );
+}
+
+AVX512 int multiply_fun_avx512(float a[], const float b[], int n, float scale)
+{
+  __m512 	vscale = _mm512_set1_ps( scale ),
+		sign = altsign_avx512(-1,1),
+		va,vb,c;
+  int 		k, done = n & ~7;
+
+    for ( k = 0; k < done+done; k += 16 ) {
+	va = _mm512_loadu_ps( a+k );
+	vb = _mm512_loadu_ps( b+k );
+	c = _mm512_mask_blend_ps( 0xaaaa, va, vb ); /* (r1,i2) */
+	c = _mm512_fmadd_ps( va, _mm512_moveldup_ps(vb), _mm512_mul_ps( _mm512_mul_ps( swap_avx512(va), c ), sign ) );
+	_mm512_storeu_ps( a+k, _mm512_mul_ps( vscale, c ) );
+    }
+    return done;
+}
+
+AVX512 int multiply_phase_amp_avx512(float a[], const float b[], int n, float scale)
+{
+  __m512 	vb,amp,bamp;
+  __mmask16 	zero;
+  int 		k, done = n & ~7;
+
+    for ( k = 0; k < done+done; k += 16 ) {
+	vb = _mm512_loadu_ps( b+k );
+	amp = abs_avx512( _mm512_loadu_ps(a+k) );
+	bamp = abs_avx512( vb );
+	zero = _mm512_cmp_ps_mask( bamp, _mm512_setzero_ps(), _CMP_EQ_OQ );
+	_mm512_storeu_ps( a+k, _mm512_mask_blend_ps( zero, _mm512_mul_ps( vb, _mm512_div_ps( amp, bamp ) ),
+						     _mm512_maskz_mov_ps( 0x5555, amp ) ) );
+    }
+    return done;
+}
+
+#endif
@@ -0,0 +1,56 @@
+
+/* SSE2, AVX2 and AVX-512 versions of the inner fft loops (see fft_simd.c).
+   The scalar versions in fft.c are used when none of these are compiled in,
+   or when the cpu does not support them.
+
+   The twiddle buffers used by the kernels hold tn twiddles laid out as 2*tn
+   floats with the real parts twice (wr,wr,...), followed by 2*tn floats with
+   the imaginary parts with alternating sign (-wi,wi,...). That way a complex
+   multiplication is two multiplications and an addition for any vector width.
+   The radix-4 buffers hold three such sections after each other.
+
+   The kernels return how many of the n positions they did, always from the
+   start. The rest is left for the scalar code. */
+
+/* The kernels are for float spectra only. */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) \
+    && !defined(MAMMUT_DOUBLE)
+#  define FFT_SIMD 1
+#endif
+
+#define FFT_SIMD_NONE 0
+#define FFT_SIMD_SSE2 1
+#define FFT_SIMD_AVX2 2
+#define FFT_SIMD_AVX512 3
+
+#ifdef FFT_SIMD
+
+/* Returns the widest of the FFT_SIMD_* kinds the running cpu supports. */
+int fft_simd_level(void);
+
+int radix4_butterflies_sse2(float x[], int L, int n, const float tw[], int tn, int forward, float scale);
+int radix4_butterflies_avx2(float x[], int L, int n, const float tw[], int tn, int forward, float scale);
+int radix4_butterflies_avx512(float x[], int L, int n, const float tw[], int tn, int forward, float scale);
+
+int rfft_split_sse2(float x[], int N, int i, int n, const float tw[], int tn, int forward);
+int rfft_split_avx2(float x[], int N, int i, int n, const float tw[], int tn, int forward);
+int rfft_split_avx512(float x[], int N, int i, int n, const float tw[], int tn, int forward);
+
+/* The methods of Load & Multiply, for n complex values. (see loadmult.c) */
+int multiply_convolve_sse2(float a[], const float b[], int n, float scale);
+int multiply_convolve_avx2(float a[], const float b[], int n, float scale);
+int multiply_convolve_avx512(float a[], const float b[], int n, float scale);
+
+int multiply_correlate_sse2(float a[], const float b[], int n, float scale);
+int multiply_correlate_avx2(float a[], const float b[], int n, float scale);
+int multiply_correlate_avx512(float a[], const float b[], int n, float scale);
+
+int multiply_fun_sse2(float a[], const float b[], int n, float scale);
+int multiply_fun_avx2(float a[], const float b[], int n, float scale);
+int multiply_fun_avx512(float a[], const float b[], int n, float scale);
+
+int multiply_phase_amp_sse2(float a[], const float b[], int n, float scale);
+int multiply_phase_amp_avx2(float a[], const float b[], int n, float scale);
+int multiply_phase_amp_avx512(float a[], const float b[], int n, float scale);
+
+#endif
@@ -0,0 +1,286 @@
+#include "mammut.h"
+#include "flacjoin.h"
+
+
+#define FLACJOIN_STREAMINFO 0
+#define FLACJOIN_SEEKTABLE 3
+
+
+/* Made by FLACJOIN_init. */
+static unsigned char crc8_table[256];
+static unsigned short crc16_table[256];
+
+void FLACJOIN_init(void)
+{
+  int i,bit;
+
+  for(i=0;i<256;i++){
+    unsigned int crc8=i;
+    unsigned int crc16=i<<8;
+    for(bit=0;bit<8;bit++){
+      crc8=(crc8<<1)^((crc8&0x80) ? 0x07 : 0);
+      crc16=(crc16<<1)^((crc16&0x8000) ? 0x8005 : 0);
+    }
+    crc8_table[i]=crc8&0xff;
+    crc16_table[i]=crc16&0xffff;
+  }
+}
+
+static unsigned int FLACJOIN_crc8(const unsigned char *data,size_t size)
+{
+  unsigned int crc=0;
+  size_t i;
+  for(i=0;i<size;i++)
+    crc=crc8_table[crc^data[i]];
+  return crc;
+}
+
+static unsigned int FLACJOIN_crc16(unsigned int crc,const unsigned char *data,size_t size)
+{
+  size_t i;
+  for(i=0;i<size;i++)
+    crc=((crc<<8)^crc16_table[(crc>>8)^data[i]])&0xffff;
+  return crc;
+}
+
+static unsigned long FLACJOIN_get(const unsigned char *data,int bytes)
+{
+  unsigned long val=0;
+  int i;
+  for(i=0;i<bytes;i++)
+    val=(val<<8)|data[i];
+  return val;
+}
+
+static void FLACJOIN_put(unsigned char *data,unsigned long val,int bytes)
+{
+  int i;
+  for(i=bytes-1;i>=0;i--){
+    data[i]=val&0xff;
+    val>>=8;
+  }
+}
+
+
+/* The frame number is coded like UTF-8. */
+
+static int FLACJOIN_numberSize(unsigned char first)
+{
+  if((first&0x80)==0)
+    return 1;
+  if((first&0xe0)==0xc0)
+    return 2;
+  if((first&0xf0)==0xe0)
+    return 3;
+  if((first&0xf8)==0xf0)
+    return 4;
+  if((first&0xfc)==0xf8)
+    return 5;
+  if((first&0xfe)==0xfc)
+    return 6;
+  return 0;
+}
+
+static unsigned long FLACJOIN_getNumber(const unsigned char *data,int bytes)
+{
+  unsigned long val;
+  int i;
+
+  if(bytes==1)
+    return data[0];
+
+  val=data[0]&(0x7f>>bytes);
+  for(i=1;i<bytes;i++)
+    val=(val<<6)|(data[i]&0x3f);
+  return val;
+}
+
+static int FLACJOIN_putNumber(unsigned char *data,unsigned long val)
+{
+  int bytes,i;
+
+  if(val<0x80){
+    data[0]=val;
+    return 1;
+  }
+
+  bytes= val<0x800 ? 2 : val<0x10000 ? 3 : val<0x200000 ? 4 : val<0x4000000 ? 5 : 6;
+  for(i=bytes-1;i>0;i--){
+    data[i]=0x80|(val&0x3f);
+    val>>=6;
+  }
+  data[0]=(0xff00>>bytes)|val;
+  return bytes;
+}
+
+
+/* Returns the size of the header of the FLAC frame at data, and sets
+   *number to its frame number, or returns 0 if there is no frame header
+   of a stream with fixed block size there. */
+static int FLACJOIN_frameHeader(const unsigned char *data,size_t size,unsigned long *number)
+{
+  int pos,numbersize;
+  int blockcode,ratecode;
+
+  if(size<6 || data[0]!=0xff || data[1]!=0xf8 || (data[3]&1)!=0)
+    return 0;
+
+  blockcode=data[2]>>4;
+  ratecode=data[2]&0xf;
+  if(blockcode==0 || ratecode==15)
+    return 0;
+
+  numbersize=FLACJOIN_numberSize(data[4]);
+  if(numbersize==0)
+    return 0;
+  pos=4+numbersize;
+
+  if(blockcode==6)
+    pos+=1;
+  else if(blockcode==7)
+    pos+=2;
+  if(ratecode==12)
+    pos+=1;
+  else if(ratecode==13 || ratecode==14)
+    pos+=2;
+
+  if((size_t)pos+1>size || FLACJOIN_crc8(data,pos)!=data[pos])
+    return 0;
+
+  *number=FLACJOIN_getNumber(data+4,numbersize);
+  return pos+1;
+}
+
+
+
+bool FLACJOIN_readHeader(const unsigned char *stream,size_t size,struct FLACJOIN_Info *info)
+{
+  size_t pos=4;
+  bool last=false;
+
+  if(size<4+4+34 || memcmp(stream,"fLaC",4)!=0 || (stream[4]&0x7f)!=FLACJOIN_STREAMINFO)
+    return false;
+
+  info->blocksize=FLACJOIN_get(stream+8,2);
+  info->minframesize=FLACJOIN_get(stream+12,3);
+  info->maxframesize=FLACJOIN_get(stream+15,3);
+  info->samples=((unsigned long long)(stream[21]&0xf)<<32) | FLACJOIN_get(stream+22,4);
+
+  if(info->blocksize!=FLACJOIN_get(stream+10,2) || info->blocksize==0)
+    return false;
+
+  while(last==false){
+    if(pos+4>size)
+      return false;
+    last=(stream[pos]&0x80)!=0;
+    pos+=4+FLACJOIN_get(stream+pos+1,3);
+  }
+  if(pos>size)
+    return false;
+  info->headersize=pos;
+
+  return true;
+}
+
+size_t FLACJOIN_maxSize(size_t size,const struct FLACJOIN_Info *info)
+{
+  /* A frame number grows by at most 5 bytes. */
+  return size+5*(size_t)(info->samples/info->blocksize+1);
+}
+
+size_t FLACJOIN_header(const unsigned char *stream,const struct FLACJOIN_Info *info,const struct FLACJOIN_Info *joined,unsigned char *out)
+{
+  size_t pos=4;
+  size_t outpos=4;
+  size_t lastblock=4;
+
+  memcpy(out,stream,4);
+
+  while(pos<info->headersize){
+    size_t blocksize=4+FLACJOIN_get(stream+pos+1,3);
+    if((stream[pos]&0x7f)!=FLACJOIN_SEEKTABLE){
+      memcpy(out+outpos,stream+pos,blocksize);
+      out[outpos]&=0x7f;
+      lastblock=outpos;
+      outpos+=blocksize;
+    }
+    pos+=blocksize;
+  }
+  out[lastblock]|=0x80;
+
+  /* STREAMINFO, which is always first. */
+  FLACJOIN_put(out+12,joined->minframesize,3);
+  FLACJOIN_put(out+15,joined->maxframesize,3);
+  out[21]=(out[21]&0xf0)|((joined->samples>>32)&0xf);
+  FLACJOIN_put(out+22,(unsigned long)(joined->samples&0xffffffff),4);
+  memset(out+26,0,16);
+
+  return outpos;
+}
+
+size_t FLACJOIN_frames(const unsigned char *stream,size_t size,const struct FLACJOIN_Info *info,unsigned long firstframe,unsigned char *out,struct FLACJOIN_Info *joined)
+{
+  unsigned long numframes=(unsigned long)((info->samples+info->blocksize-1)/info->blocksize);
+  unsigned long frame;
+  size_t start=info->headersize;
+  size_t outpos=0;
+
+  for(frame=0;frame<numframes;frame++){
+    unsigned long number;
+    int headersize=FLACJOIN_frameHeader(stream+start,size-start,&number);
+    unsigned int crc;
+    size_t end;
+    size_t framesize;
+    unsigned char *outframe=out+outpos;
+    int outheadersize;
+    int extrasize;
+
+    if(headersize==0 || number!=frame)
+      return 0;
+
+    /* The frame ends where its checksum makes the checksum of all of it
+       zero, and the next frame starts. The next frame number is checked
+       too, so that bytes looking like a frame header inside a frame are
+       not taken for one. */
+    crc=FLACJOIN_crc16(0,stream+start,headersize);
+    for(end=start+headersize;end<size;end++){
+      unsigned long next;
+      crc=FLACJOIN_crc16(crc,stream+end,1);
+      if(crc!=0)
+	continue;
+      if(frame==numframes-1){
+	if(end==size-1)
+	  break;
+      }else if(end+1<size && stream[end+1]==0xff
+	       && FLACJOIN_frameHeader(stream+end+1,size-end-1,&next)>0 && next==frame+1)
+	break;
+    }
+    if(end==size)
+      return 0;
+    end++;
+
+    /* The frame anew, with its new number and checksums. The block size
+       and sample rate that may follow the number are kept. */
+    extrasize=headersize-1-4-FLACJOIN_numberSize(stream[start+4]);
+    memcpy(outframe,stream+start,4);
+    outheadersize=4+FLACJOIN_putNumber(outframe+4,firstframe+frame);
+    memcpy(outframe+outheadersize,stream+start+headersize-1-extrasize,extrasize);
+    outheadersize+=extrasize;
+    outframe[outheadersize]=FLACJOIN_crc8(outframe,outheadersize);
+    outheadersize++;
+
+    framesize=outheadersize+(end-start-headersize);
+    memcpy(outframe+outheadersize,stream+start+headersize,end-start-headersize-2);
+    FLACJOIN_put(outframe+framesize-2,FLACJOIN_crc16(0,outframe,framesize-2),2);
+
+    if(joined->minframesize==0 || framesize<joined->minframesize)
+      joined->minframesize=framesize;
+    if(framesize>joined->maxframesize)
+      joined->maxframesize=framesize;
+
+    outpos+=framesize;
+    start=end;
+  }
+
+  return outpos;
+}
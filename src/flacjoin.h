@@ -0,0 +1,40 @@
+
+/* Joining FLAC streams that were encoded separately, one segment of the
+   sound each, into one stream, so that FLAC files can be encoded on all
+   CPUs at the same time. (see writesound_flac in save.c)
+
+   The frames of a FLAC stream do not depend on each other, so the frames
+   of the segments can be put after each other as they are, as long as
+   all of them except the last hold the same number of frames of sound.
+   Only the number of each frame, and the two checksums covering it, are
+   written anew. The header is the one of the first stream, with the
+   length and frame sizes of the whole stream, without the seek table, and
+   without the MD5 sum of the sound, which FLAC allows to be left out. */
+
+struct FLACJOIN_Info{
+  unsigned int blocksize; /* frames of sound in each FLAC frame */
+  unsigned int minframesize;
+  unsigned int maxframesize;
+  unsigned long long samples; /* frames of sound in the stream */
+  size_t headersize; /* bytes before the first FLAC frame */
+};
+
+/* Makes the checksum tables. Must be called once before the rest. */
+extern LANGSPEC void FLACJOIN_init(void);
+
+/* Reads the header of stream, which is size bytes. Returns false if it
+   is not a FLAC stream, or if its FLAC frames do not all hold the same
+   number of frames of sound. */
+extern LANGSPEC bool FLACJOIN_readHeader(const unsigned char *stream,size_t size,struct FLACJOIN_Info *info);
+
+/* The most bytes FLACJOIN_header and FLACJOIN_frames can put in out. */
+extern LANGSPEC size_t FLACJOIN_maxSize(size_t size,const struct FLACJOIN_Info *info);
+
+/* Puts the header of stream in out, with the values of joined, which
+   describes the whole joined stream. Returns the number of bytes. */
+extern LANGSPEC size_t FLACJOIN_header(const unsigned char *stream,const struct FLACJOIN_Info *info,const struct FLACJOIN_Info *joined,unsigned char *out);
+
+/* Puts the FLAC frames of stream in out, numbered from firstframe on, and
+   updates the frame sizes in joined. Returns the number of bytes, or 0 if
+   the frames could not be found. */
+extern LANGSPEC size_t FLACJOIN_frames(const unsigned char *stream,size_t size,const struct FLACJOIN_Info *info,unsigned long firstframe,unsigned char *out,struct FLACJOIN_Info *joined);
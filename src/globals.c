@@ -12,7 +12,7 @@ int  samp_type;
 int  vers;
 long framecnt, N=0;
 
-float *lyd=NULL, *lyd2=NULL;
+spectrum_t *lyd=NULL, *lyd2=NULL;
 
 float duration;		    /* Duration in secs */
 int numchannels;	    /* Number of FFT channels */
@@ -31,4 +31,7 @@ bool prefs_picture=true;
 bool prefs_animation=true;
 bool prefs_movingcamera=false;
 bool prefs_loop=true;
+int prefs_fftthreads=0;      /* 0 = one thread per cpu */
+int prefs_speccache_mb=4096; /* 0 = no spectrum cache */
+int prefs_save_samplerate=0; /* 0 = the rate of the sound */
 
@@ -27,6 +27,9 @@ I'm sorry about all the non-C++ stuff. I'm not a big C++ fan.
 #include "juce.h"
 #include "mammut.h"
 #include "juceplay.h"
+#include "bigmem.h"
+#include "resample.h"
+#include "render.h"
 
 #include "oggsoundholder.h"
 #include <vorbis/codec.h>
@@ -108,23 +111,110 @@ static long oggtell_func  (void *datasource){
 
 
 int jp_playpos;
+int jp_playlength;
 bool jp_isplaying=false;
-static float normalize_val;
 
-static void source_init(void){
-  int progval=0;
+/* What is played. It is made out of place, so lyd keeps the spectrum.
+
+   The whole sound comes from the render cache (see render.h), which keeps
+   it until the spectrum changes, and which has usually made it in the
+   background already. When the sound card does not run at the rate of the
+   sound, the sound is made straight from the spectrum at the rate of the
+   card, so it does not have to be resampled while playing. (see
+   resample.h) libsamplerate is still used if that is not possible.
+
+   Large sounds that are not in the cache first get a preview, made from
+   the lowest bins of the spectrum at a lower rate, which takes a small
+   part of the time. Playing starts with the preview while the whole sound
+   is made on a thread of its own, and the audio callback switches to it
+   when it is ready. */
+
+struct source{
+  spectrum_t *sound; /* length frames of each channel after each other */
+  long length;
+  double rate;
+  float normalize_val;
+};
 
-  memcpy(lyd2,lyd,samps_per_frame*N*sizeof(float));
-  
-  for (int ch=0; ch<samps_per_frame; ch++) {
-    GUI_aboveprogressbar(ch,samps_per_frame); 
-    rfft(lyd+ch*N,  N/2,  INVERSE);
+/* Sounds with at least this many values in all get a preview. */
+#define SOURCE_PREVIEW_MIN (1<<22)
+
+/* The lowest sample rate of a preview. */
+#define SOURCE_PREVIEW_MINRATE 5000
+
+static int source_cardrate;
+static struct source source_full={0};
+static struct source source_preview={0};
+static struct source *volatile source_playing=&source_full;
+static volatile bool source_fullready=false;
+
+static void source_render(struct source *s){
+  const struct RenderSound *sound=RENDER_get(source_cardrate);
+
+  if(sound==NULL){
+    fprintf(stderr,"Not enough memory or temporary disk space to make the sound\n");
+    s->sound=NULL;
+    s->length=0;
+    s->rate=R;
+    return;
   }
-  
-  normalize_val=get_normalize_val();
-  //fprintf(stderr,"source_init finished\n");
-  //if(synthandsave_normalize_gain)
-  //  normalize();
+
+  s->sound=sound->sound;
+  s->length=sound->length;
+  s->rate=sound->rate;
+  s->normalize_val=sound->normalize_val;
+}
+
+static void source_free(struct source *s){
+  if(s==&source_preview)
+    BIGMEM_free(s->sound);
+  s->sound=NULL;
+}
+
+/* The preview is this many times shorter than the sound, or 1 if there
+   should be none. */
+static int source_previewfactor(void){
+  int factor=1;
+
+  if((long)N*samps_per_frame < SOURCE_PREVIEW_MIN || RENDER_isReady(source_cardrate))
+    return 1;
+  while(R/(factor*2) >= SOURCE_PREVIEW_MINRATE && N%(factor*4)==0)
+    factor*=2;
+  return factor;
+}
+
+/* Called by the render thread when the whole sound is ready. (see
+   RENDER_start) */
+static void source_fullmade(const struct RenderSound *sound){
+  source_full.sound=sound->sound;
+  source_full.length=sound->length;
+  source_full.rate=sound->rate;
+  source_full.normalize_val=sound->normalize_val;
+  source_fullready=true;
+}
+
+static void source_init(void){
+  int factor=source_previewfactor();
+
+  source_fullready=false;
+
+  if(factor>1){
+    source_preview.sound=RESAMPLE_decimate(lyd,N,samps_per_frame,factor);
+    if(source_preview.sound!=NULL){
+      source_preview.length=N/factor;
+      source_preview.rate=(double)R/factor;
+      source_preview.normalize_val=get_normalize_val(source_preview.sound,source_preview.length,samps_per_frame);
+      if(RENDER_start(source_cardrate,source_fullmade)==true){
+	source_playing=&source_preview;
+	return;
+      }
+      source_free(&source_preview);
+    }
+  }
+
+  source_render(&source_full);
+  source_playing=&source_full;
+  source_fullready=source_full.sound!=NULL;
 }
 
 class JucePlayer : public AudioIODeviceCallback, public ChangeListener
@@ -213,7 +303,23 @@ public:
   int getSourceLength(){
     if(isplaying_ogg)
       return ov_pcm_total(&oggvorbisfile,-1);
-    return N;
+    return source_playing->length;
+  }
+
+  spectrum_t *getSourceChannel(int channel){
+    return source_playing->sound+channel*source_playing->length;
+  }
+
+  // Called from the audio callback. Continues at the same time in the
+  // whole sound.
+  void switchFromPreview(){
+    jp_playpos=(int)((double)jp_playpos*source_full.rate/source_preview.rate);
+    source_playing=&source_full;
+    jp_playlength=source_full.length;
+    for(int i=0;i<num_src_states;i++)
+      src_reset(src_states[i]);
+    if(jp_playpos>=getSourceLength())
+      jp_playpos=0;
   }
   
   void getOggData(float **dst,int num_frames){
@@ -272,27 +378,51 @@ public:
     }
   }
 
+#ifdef MAMMUT_DOUBLE
+  // The sound card wants floats. The returned data is valid until the next call.
+  float *getSourceData(int channel,int position,int num_frames){
+    static float *data=NULL;
+    static int datasize=0;
+    spectrum_t *l=getSourceChannel(channel)+position;
+    if(num_frames>datasize){
+      delete[] data;
+      data=new float[num_frames];
+      datasize=num_frames;
+    }
+    for(int i=0;i<num_frames;i++)
+      data[i]=(float)l[i];
+    return data;
+  }
+#else
   float *getSourceData(int channel,int position,int num_frames){
-    return lyd+(position+(channel*N));
+    return getSourceChannel(channel)+position;
   }
+#endif
   double getSourceRate(){
-    return (double)R;
+    return source_playing->rate;
   }
   int getSourceNumChannels(){
     return samps_per_frame;
   }
+  // The whole sound may still be being made. That goes on into the
+  // render cache (see render.h) without being waited for.
   void sourceCleanup(){
-    memcpy(lyd,lyd2,getSourceNumChannels()*N*sizeof(float));
+    RENDER_stopNotify();
+    source_fullready=false;
+    source_free(&source_preview);
+    source_free(&source_full);
+    source_playing=&source_full;
   }
 
   void insertDataResample(float **outdata,int frames,int num_channels){
     static float nulldata[512]={0.0f};
     int last_consumed=0;
     double ratio=samplerate/getSourceRate();
+    int num_input=mustrunonemore==true?512:JP_MIN((long)(64+1.2*frames/ratio),getSourceLength()-jp_playpos);
     for(int ch=0;ch<num_channels;ch++){
       SRC_DATA src_data={
-	mustrunonemore==true?nulldata:getSourceData(ch,jp_playpos,1024), outdata[ch],
-	mustrunonemore==true?512:JP_MIN((long)(64+1.2*frames/ratio),getSourceLength()-jp_playpos), frames,
+	mustrunonemore==true?nulldata:getSourceData(ch,jp_playpos,num_input), outdata[ch],
+	num_input, frames,
 	0,0,
 	0,
 	ratio
@@ -389,7 +519,10 @@ public:
       return;
     }
 
-    if( (fabs(((double)R) - samplerate)) > 0.1){
+    if(source_playing==&source_preview && source_fullready==true)
+      switchFromPreview();
+
+    if( (fabs(getSourceRate() - samplerate)) > 0.1){
       insertDataResample(outputChannelData,numSamples,num_channels);
     }else{
       insertData(outputChannelData,numSamples,num_channels);
@@ -398,7 +531,7 @@ public:
     if(synthandsave_normalize_gain)
       for(int ch=0;ch<num_channels;ch++)
 	for(int i=0;i<numSamples;i++)
-	  outputChannelData[ch][i]*=normalize_val;
+	  outputChannelData[ch][i]*=source_playing->normalize_val;
 
 
     // Play mono files in both loudspeakers.
@@ -423,7 +556,12 @@ public:
 
     stop();
 
+    source_cardrate=(int)(samplerate+0.5);
     GUI_newprocess(source_init);
+    if(source_playing->sound==NULL){
+      printerror("Not enough memory or temporary disk space to play the sound.");
+      return;
+    }
     //source_init();
     //fprintf(stderr,"GUI_newprocess finished\n");
 
@@ -460,6 +598,7 @@ public:
 
     pleasestop=false;
     jp_playpos=0;
+    jp_playlength=getSourceLength();
     mustrunonemore=false;
     jp_isplaying=true;
     isreadingdata=true;
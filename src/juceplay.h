@@ -10,5 +10,6 @@ extern LANGSPEC void juceplay_stop();
 extern LANGSPEC void juceplay_prefs();
 
 extern int jp_playpos;
+extern int jp_playlength; /* frames in what is played, N unless converted */
 extern bool jp_isplaying;
 
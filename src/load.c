@@ -1,5 +1,10 @@
 
 #include "mammut.h"
+#include "bigmem.h"
+#include "workers.h"
+#include "mapsound.h"
+#include "speccache.h"
+#include "render.h"
 
 
 /* Following code copied from Ceres. */
@@ -8,45 +13,393 @@ struct LoadStruct loadstruct;
 
 
 
-/* ly=destination, spf=samples per frame. */
+/* Frames read at a time by the reader thread in readsound, or by the
+   workers from a mapped file. */
+#define READSOUND_BLOCK 65536
 
-void readsound(struct LoadStruct *ls,float *ly, int channels)
+/* Frames converted at a time from a mapped file before they are put into
+   fft order. */
+#define READSOUND_CHUNK 1024
+
+/* Compressed files are decoded in segments of at least this many frames
+   at the same time. (see readsound_segments) */
+#define READSOUND_SEGMENT_MIN (1<<20)
+
+
+struct readsound_buffer{
+  spectrum_t *frames;
+  int num_frames;
+  struct WORKERS_Event *filled;
+  struct WORKERS_Event *empty;
+};
+
+struct readsound_job{
+  struct LoadStruct *ls;
+  struct readsound_buffer buffers[2];
+
+  spectrum_t *ly;
+  long length;
+  int channels;
+  bool fftorder;
+
+  /* Where the current buffer goes. */
+  const spectrum_t *frames;
+  int num_frames;
+  long r;
+  int pos;
+  struct fft_inputorder order;
+  bool stop;
+
+  /* Where the next buffer goes. */
+  int next_pos;
+  struct fft_inputorder next_order;
+};
+
+
+/* The reader thread. Fills the two buffers in turn, until the end of the
+   file, which is marked with an empty buffer. */
+static void readsound_reader(void *arg)
 {
+  struct readsound_job *job=arg;
+  struct readsound_buffer *buffer;
+  int b=0;
+
+  do{
+    buffer=&job->buffers[b];
+    WORKERS_waitEvent(buffer->empty);
+    if(job->stop)
+      buffer->num_frames=0;
+    else
+      buffer->num_frames=sf_readf_spectrum(job->ls->infile,buffer->frames,READSOUND_BLOCK);
+    if(buffer->num_frames<0)
+      buffer->num_frames=0;
+    WORKERS_signalEvent(buffer->filled);
+    b=1-b;
+  }while(buffer->num_frames>0);
+}
+
+
+/* Puts num samples from src, stride values apart, into l. r is where
+   the first one goes in the sound. order is NULL for the natural order. */
+static void readsound_put(spectrum_t *l,const spectrum_t *src,int stride,long r,int num,struct fft_inputorder *order,int *pos)
+{
+  int lokke;
+
+  if(order==NULL){
+    for(lokke=0;lokke<num;lokke++)
+      l[r+lokke]=src[lokke*stride];
+  }else{
+    for(lokke=0;lokke<num;lokke++){
+      int odd=(r+lokke)&1;
+      if(odd==0)
+	*pos=fft_inputorder_next(order);
+      l[2*(*pos)+odd]=src[lokke*stride];
+    }
+  }
+}
+
+
+/* De-interleaves the current buffer, or the current block of the mapped
+   file, with the channels split between the workers. In fft order, every
+   channel follows the same positions, so the state after the buffer is
+   kept from channel 0 for the next one. */
+static void readsound_deinterleave_job(void *arg,int worker,int num_workers)
+{
+  struct readsound_job *job=arg;
+  int filechannels=job->ls->sfinfo.channels;
+  int per=(job->channels+num_workers-1)/num_workers;
   int ch;
 
-  static int lastchannels=0;
-  static float *val3 = NULL;
-  if(ls->sfinfo.channels>lastchannels){
-    free(val3);
-    val3 = malloc (sizeof(float)*(ls->sfinfo.channels*8192));
-    lastchannels=ls->sfinfo.channels;
+  for(ch=worker*per;ch<job->channels && ch<(worker+1)*per;ch++){
+    spectrum_t *l=job->ly+(ch*job->length);
+    struct fft_inputorder order=job->order;
+    int pos=job->pos;
+    struct fft_inputorder *porder=job->fftorder ? &order : NULL;
+
+    if(job->ls->map==NULL)
+      readsound_put(l,job->frames+ch,filechannels,job->r,job->num_frames,porder,&pos);
+
+    else if(porder==NULL)
+      MAPSOUND_read(job->ls->map,ch,job->r,job->num_frames,l+job->r);
+
+    else{
+      spectrum_t samples[READSOUND_CHUNK];
+      int done,num;
+      for(done=0;done<job->num_frames;done+=num){
+	num=mammut_min(READSOUND_CHUNK,job->num_frames-done);
+	MAPSOUND_read(job->ls->map,ch,job->r+done,num,samples);
+	readsound_put(l,samples,1,job->r+done,num,porder,&pos);
+      }
+    }
+
+    if(ch==0){
+      job->next_order=order;
+      job->next_pos=pos;
+    }
+  }
+}
+
+
+static bool readsound_cancelled(struct readsound_job *job)
+{
+  return job->ls->cancel!=NULL && *job->ls->cancel==true;
+}
+
+
+/* The next block is read by the workers while the system reads the one
+   after it from the disk. */
+static bool readsound_mapped(struct readsound_job *job)
+{
+  long frames=mammut_min(job->length,(long)job->ls->sfinfo.MSF_FRAMENAME);
+
+  MAPSOUND_prefetch(job->ls->map,0,READSOUND_BLOCK);
+
+  for(job->r=0;job->r<frames;job->r+=job->num_frames){
+    if(readsound_cancelled(job))
+      return false;
+    job->num_frames=mammut_min(READSOUND_BLOCK,frames-job->r);
+    MAPSOUND_prefetch(job->ls->map,job->r+job->num_frames,READSOUND_BLOCK);
+    WORKERS_run(readsound_deinterleave_job,job,mammut_min(job->channels,WORKERS_getNum()));
+    job->order=job->next_order;
+    job->pos=job->next_pos;
   }
 
-  for(ch=0;ch<channels;ch++){
-    float *l=ly+(ch*N);
-    int sampsread;
-    int r=0;
-    sf_seek(ls->infile,0,SEEK_SET);
-    do{
-      int ret,lokke;
-      
-      ret=sf_readf_float(ls->infile,val3,8192);
-      for(lokke=0;lokke<ret;lokke++)
-	*(l+r+lokke)=val3[ch+lokke*ls->sfinfo.channels];
-
-      sampsread=ret;
-
-      r+=sampsread;
-    }while(sampsread>0);
+  return true;
+}
+
+
+/* The file is decoded once, by a reader thread filling one buffer while
+   the other is de-interleaved into all channels at the same time. */
+static bool readsound_decoded(struct readsound_job *job)
+{
+  struct WORKERS_Thread *reader;
+  int b;
+  bool ret=true;
+
+  for(b=0;b<2;b++){
+    job->buffers[b].frames=malloc(sizeof(spectrum_t)*job->ls->sfinfo.channels*READSOUND_BLOCK);
+    if(job->buffers[b].frames==NULL)
+      ret=false;
+    job->buffers[b].filled=WORKERS_newEvent();
+    job->buffers[b].empty=WORKERS_newEvent();
+    WORKERS_signalEvent(job->buffers[b].empty);
   }
 
+  if(ret==true){
+    sf_seek(job->ls->infile,0,SEEK_SET);
+    reader=WORKERS_startThread(readsound_reader,job);
+
+    for(b=0;;b=1-b){
+      struct readsound_buffer *buffer=&job->buffers[b];
+      WORKERS_waitEvent(buffer->filled);
+      if(buffer->num_frames==0)
+	break;
+
+      /* The reader stops after the next buffer. */
+      if(readsound_cancelled(job)){
+	job->stop=true;
+	ret=false;
+      }
+
+      if(job->stop==false){
+	job->frames=buffer->frames;
+	job->num_frames=mammut_min(buffer->num_frames,job->length-job->r);
+	WORKERS_run(readsound_deinterleave_job,job,mammut_min(job->channels,WORKERS_getNum()));
+	job->r+=job->num_frames;
+	job->order=job->next_order;
+	job->pos=job->next_pos;
+      }
+
+      WORKERS_signalEvent(buffer->empty);
+    }
+
+    WORKERS_waitThread(reader);
+  }
+
+  for(b=0;b<2;b++){
+    free(job->buffers[b].frames);
+    WORKERS_freeEvent(job->buffers[b].filled);
+    WORKERS_freeEvent(job->buffers[b].empty);
+  }
+
+  return ret;
+}
+
+
+/* ly=destination, with length values for each channel. If fftorder is
+   true, the samples are put straight into the order the forward fft of
+   the channels wants them in (see fft_inputorder_init), so that it can
+   skip putting them there itself.
+
+   If ls->map is set, the samples are converted straight from the mapped
+   file, otherwise they are decoded by libsndfile. Returns false if there
+   was not enough memory for the buffers, or if *ls->cancel became true. */
+
+bool readsound(struct LoadStruct *ls,spectrum_t *ly, int channels, long length, bool fftorder)
+{
+  struct readsound_job job;
+
+  memset(&job,0,sizeof(job));
+  job.ls=ls;
+  job.ly=ly;
+  job.length=length;
+  job.channels=channels;
+  job.fftorder=fftorder;
+  if(fftorder)
+    fft_inputorder_init(&job.order,ly,length/2,ls->sfinfo.MSF_FRAMENAME);
+
+  if(ls->map!=NULL)
+    return readsound_mapped(&job);
+
+  return readsound_decoded(&job);
+}
+
+
+
+/* Decoding of compressed files (FLAC and Ogg) in segments at the same
+   time, one segment for each worker, all with their own handle to the
+   file. libsndfile finds the start of each segment with the seek table of
+   FLAC files, and the granule positions of the Ogg pages. */
+
+struct readsound_segments_job{
+  struct LoadStruct *ls;
+  const char *filename;
+  spectrum_t *ly;
+  long length;
+  long frames;
+  struct fft_inputorder order;
+  volatile bool failed;
+};
+
+static void readsound_segments_job(void *arg,int worker,int num_workers)
+{
+  struct readsound_segments_job *job=arg;
+  int channels=job->ls->sfinfo.channels;
+
+  /* Even, so that the two halves of a complex value are read together. */
+  long per=((job->frames+num_workers-1)/num_workers+1)&~1L;
+  long start=mammut_min(job->frames,worker*per);
+  long end=mammut_min(job->frames,start+per);
+  long r;
+  int num;
+
+  struct fft_inputorder order=job->order;
+  int pos=0;
+  SF_INFO sfinfo;
+  SNDFILE *infile;
+  spectrum_t *frames;
+
+  if(start>=end)
+    return;
+
+  memset(&sfinfo,0,sizeof(SF_INFO));
+  infile=sf_open_read(job->filename,&sfinfo);
+  frames=malloc(sizeof(spectrum_t)*channels*READSOUND_BLOCK);
+
+  if(infile==NULL || frames==NULL || sfinfo.channels!=channels || sf_seek(infile,start,SEEK_SET)!=start)
+    job->failed=true;
+
+  fft_inputorder_seek(&order,start/2);
+
+  for(r=start;r<end && job->failed==false;r+=num){
+    struct fft_inputorder chorder;
+    int chpos=0;
+    int ch;
+
+    if(job->ls->cancel!=NULL && *job->ls->cancel==true){
+      job->failed=true;
+      break;
+    }
+
+    num=sf_readf_spectrum(infile,frames,mammut_min(READSOUND_BLOCK,end-r));
+    if(num<=0){
+      job->failed=true;
+      break;
+    }
+
+    for(ch=0;ch<channels;ch++){
+      chorder=order;
+      chpos=pos;
+      readsound_put(job->ly+(ch*job->length),frames+ch,channels,r,num,&chorder,&chpos);
+    }
+    order=chorder;
+    pos=chpos;
+  }
+
+  free(frames);
+  if(infile!=NULL)
+    sf_close(infile);
+}
+
+/* Returns false if the file is not compressed, or too short to split, or
+   if something went wrong. readsound is used instead then. */
+static bool readsound_segments(struct LoadStruct *ls,const char *filename,spectrum_t *ly,long length)
+{
+#ifdef SNDFILE_0
+  return false;
+#else
+  struct readsound_segments_job job;
+  int major=ls->sfinfo.format&SF_FORMAT_TYPEMASK;
+  long frames=mammut_min(length,(long)ls->sfinfo.frames);
+  int num_workers=mammut_min(WORKERS_getNum(),frames/READSOUND_SEGMENT_MIN);
+
+  if(major!=SF_FORMAT_FLAC && major!=SF_FORMAT_OGG)
+    return false;
+  if(ls->sfinfo.seekable==0 || num_workers<2 || WORKERS_isBackground())
+    return false;
+
+  memset(&job,0,sizeof(job));
+  job.ls=ls;
+  job.filename=filename;
+  job.ly=ly;
+  job.length=length;
+  job.frames=frames;
+  fft_inputorder_init(&job.order,ly,length/2,ls->sfinfo.frames);
+
+  WORKERS_run(readsound_segments_job,&job,num_workers);
+
+  if(job.failed==true && (ls->cancel==NULL || *ls->cancel==false))
+    fprintf(stderr,"Could not decode %s in segments. Decoding it from the start instead.\n",filename);
+
+  return job.failed==false;
+#endif
+}
+
+
+/* Reads the sound in ls (opened from filename) into ly, which has length
+   zeroed values for each channel, and does the forward fft of it.
+   Returns false if readsound did. */
+
+bool analyzesound(struct LoadStruct *ls,const char *filename,spectrum_t *ly,long length)
+{
+  bool ok;
+
+  ls->map=MAPSOUND_open(filename,&ls->sfinfo);
+
+  if(ls->map==NULL && readsound_segments(ls,filename,ly,length)==true)
+    ok=true;
+  else
+    ok=readsound(ls,ly,ls->sfinfo.channels,length,true);
+
+  MAPSOUND_close(ls->map);
+  ls->map=NULL;
+
+  if(ok==true && ls->cancel!=NULL && *ls->cancel==true)
+    ok=false;
+
+  if(ok==true)
+    rfft_channels_forward_pruned(ly, length/2, ls->sfinfo.channels, ls->sfinfo.MSF_FRAMENAME, true);
+
+  return ok;
 }
 
 
 
 static char *das_loadana(char *filename)
 {
-  int i,ch;
+  int i;
+  struct SpecCacheKey key;
+  bool usekey;
   SNDFILE *infile;
 
   SF_INFO *sfinfo=&loadstruct.sfinfo;
@@ -75,34 +428,61 @@ static char *das_loadana(char *filename)
   */
 
 
-  N=1;
-  while (N<framecnt)
-    N*=2;
+  N=fft_fastsize(framecnt);
   for (i=0; i<dobler; i++)
     N*=2;
 
   duration = (float)framecnt/R;
   binfreq = (float)R/N;
-  if (lyd!=NULL) free(lyd);
+  BIGMEM_free(lyd);
   lyd=NULL;
+  BIGMEM_free(lyd2);
+  lyd2=NULL;
+  load_and_multiply_newsize();
 
   //printf("N: %d, framecnt: %d, dobler: %d, samps_per_frame: %d, sfinfo->channels: %d, R: %d\n",N,framecnt,dobler,samps_per_frame,sfinfo->channels,R);
 
-  fvec(lyd, N*samps_per_frame);
+  {
+    char message[200];
+    sprintf(message,"Spectrum memory: %lu MB (%s precision)",
+	    (unsigned long)(((double)2*N*samps_per_frame*sizeof(spectrum_t))/(1024*1024)),
+	    sizeof(spectrum_t)==sizeof(double) ? "double" : "single");
+    GUI_progressmessage(message);
+  }
 
-  if (lyd2!=NULL) free(lyd2);
-  lyd2=NULL;
-  fvec(lyd2, N*samps_per_frame);
+  lyd=BIGMEM_alloc(N*samps_per_frame);
+  lyd2=BIGMEM_alloc(N*samps_per_frame);
+  if (lyd==NULL || lyd2==NULL) {
+    BIGMEM_free(lyd);
+    lyd=NULL;
+    BIGMEM_free(lyd2);
+    lyd2=NULL;
+    N=0;
+    sf_close(infile);
+    return "Not enough memory or temporary disk space";
+  }
 
-  readsound(&loadstruct,lyd,samps_per_frame);
+  usekey=SPECCACHE_makeKey(&key,filename,sfinfo,N,dobler);
+  if(usekey==true && SPECCACHE_load(&key,lyd)==true){
+    sf_close(infile);
+    strcpy(playfile, filename);
+    return NULL;
+  }
+
+  if(analyzesound(&loadstruct,filename,lyd,N)==false){
+    BIGMEM_free(lyd);
+    lyd=NULL;
+    BIGMEM_free(lyd2);
+    lyd2=NULL;
+    N=0;
+    sf_close(infile);
+    return "Not enough memory";
+  }
 
   sf_close(infile);
 
-  for (ch=0; ch<samps_per_frame; ch++) {
-    printf("CH: %d/%d\n",ch,samps_per_frame);
-    GUI_aboveprogressbar(ch,samps_per_frame);
-    rfft(lyd+ch*N,  N/2,  FORWARD);
-  }
+  if(usekey==true)
+    SPECCACHE_store(&key,lyd);
 
   strcpy(playfile, filename);
 
@@ -120,8 +500,11 @@ void das_das_loadana(void){
 
 char *loadana(char *filename){
   das_filename=filename;
+  MC_spectrumChanging();
   GUI_newprocess(das_das_loadana);
   RedrawWin();
+  if(das_ret==NULL)
+    RENDER_speculate();
   return das_ret;
 }
 
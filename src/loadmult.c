@@ -1,5 +1,13 @@
 
 #include "mammut.h"
+#include "bigmem.h"
+#include "speccache.h"
+#include "workers.h"
+#include "fft_simd.h"
+#include "render.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /* Default values must be set because the buttons arent made with glade. */
 bool loadandmultiply_convolve=true;
@@ -9,23 +17,210 @@ bool loadandmultiply_a_b=false;
 bool loadandmultiply_phase_amp=false;
 
 
+/* The spectrum of the last file multiplied with is kept, so that trying
+   the same impulse or modulator on several sounds, or with several
+   methods, only analyzes it once. It is analyzed to the size of the
+   spectrum it is multiplied with, so it can be used again as long as the
+   loaded sounds have that size. Otherwise it is looked for in the
+   spectrum cache before analyzing it. */
+
+static spectrum_t *partner=NULL;
+static char partner_filename[500];
+static time_t partner_mtime;
+static long partner_N;
+static long partner_fastsize; /* fft_fastsize of its length */
+static int partner_channels;
+
+static bool partner_mtimeOf(const char *filename,time_t *mtime){
+  struct stat st;
+  if(stat(filename,&st)!=0)
+    return false;
+  *mtime=st.st_mtime;
+  return true;
+}
+
+static void partner_free(void){
+  BIGMEM_free(partner);
+  partner=NULL;
+  partner_filename[0]=0;
+}
+
+static bool partner_is(const char *filename,long N2,int channels){
+  time_t mtime;
+  return partner!=NULL
+    && !strcmp(partner_filename,filename)
+    && partner_N==N2
+    && partner_channels==channels
+    && partner_mtimeOf(filename,&mtime)==true
+    && mtime==partner_mtime;
+}
+
+/* The spectrum cache entry of a partner padded to N2 is the same as the
+   one of a loaded sound with the duration doubled, when N2 is such a
+   size. */
+static int partner_dobler(long N2,long framecnt2){
+  long n=fft_fastsize(framecnt2);
+  int dobler=0;
+  while(n<N2){
+    n*=2;
+    dobler++;
+  }
+  return n==N2 ? dobler : SPECCACHE_PADDED;
+}
+
+/* Called when a sound is loaded, before lyd and lyd2 are allocated. The
+   partner is only kept if it can be used with the new size, and lyd and
+   lyd2 still fit in memory next to it. Otherwise it is freed, so that it
+   does not push them into temporary files. It is then found in the
+   spectrum cache again the next time. */
+void load_and_multiply_newsize(void){
+  if(partner!=NULL
+     && (partner_N!=mammut_max(partner_fastsize,N)
+	 || BIGMEM_hasRoom(2*(size_t)N*samps_per_frame)==false))
+    partner_free();
+}
+
+
+/* The methods. Each one puts the result of n complex values of a (the
+   loaded sound) and b (the partner) into a. The SIMD kernels in
+   fft_simd.c do the same for the first values, and return how many they
+   did. */
+
+typedef void (*multiply_func)(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale);
+typedef int (*multiply_kernel)(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale);
+
+static void multiply_convolve(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale){
+  spectrum_t r1, r2, i1, i2;
+  int i;
+  for (i=0; i<n; i++) {
+    r1=a[i+i]; r2=b[i+i];
+    i1=a[i+i+1]; i2=b[i+i+1];
+    a[i+i]=(r1*r2-i1*i2)*scale;
+    a[i+i+1]=(i1*r2+r1*i2)*scale;
+  }
+}
+
+static void multiply_correlate(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale){
+  spectrum_t r1, r2, i1, i2;
+  int i;
+  for (i=0; i<n; i++) {
+    r1=a[i+i]; r2=b[i+i];
+    i1=a[i+i+1]; i2=b[i+i+1];
+    a[i+i]=(r1*r2+i1*i2)*scale;
+    a[i+i+1]=(i1*r2-r1*i2)*scale;
+  }
+}
+
+static void multiply_fun(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale){
+  spectrum_t r1, r2, i1, i2;
+  int i;
+  for (i=0; i<n; i++) {
+    r1=a[i+i]; r2=b[i+i];
+    i1=a[i+i+1]; i2=b[i+i+1];
+    a[i+i]=(r1*r2-i1*r1)*scale;
+    a[i+i+1]=(i1*r2+r1*i2)*scale;
+  }
+}
+
+static void multiply_a_b(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale){
+  spectrum_t r2, i2, amp;
+  int i;
+  for (i=0; i<n; i++) {
+    r2=b[i+i]; i2=b[i+i+1];
+    amp=sqrt(r2*r2+i2*i2)+1.;
+    a[i+i]=copysign(powf(fabs(a[i+i]), amp), a[i+i]);
+    a[i+i+1]=copysign(powf(fabs(a[i+i+1]), amp), a[i+i+1]);
+  }
+}
+
+/* The amplitude of a with the phase of b. amp*cos(atan2(i2,r2)) is the
+   same as r2*amp/|b|, which is much quicker. */
+static void multiply_phase_amp(spectrum_t a[], const spectrum_t b[], int n, spectrum_t scale){
+  spectrum_t r1, r2, i1, i2, amp, bamp;
+  int i;
+  for (i=0; i<n; i++) {
+    r1=a[i+i]; r2=b[i+i];
+    i1=a[i+i+1]; i2=b[i+i+1];
+    amp=sqrt(r1*r1+i1*i1);
+    bamp=sqrt(r2*r2+i2*i2);
+    if (bamp==0) {
+      a[i+i]=amp;
+      a[i+i+1]=0;
+    } else {
+      a[i+i]=r2*(amp/bamp);
+      a[i+i+1]=i2*(amp/bamp);
+    }
+  }
+}
+
+/* Complex values done by each worker at least, so that small spectra are
+   not split. */
+#define MULTIPLY_MIN_PER_WORKER (1<<16)
+
+struct multiply_job{
+  multiply_func func;
+  multiply_kernel kernel; /* NULL if there is none */
+  int channels;
+  int n;
+  int N2;
+  spectrum_t scale;
+};
+
+static void multiply_job(void *arg,int worker,int num_workers)
+{
+  struct multiply_job *job=arg;
+  int per=((job->n+num_workers-1)/num_workers+15)&~15;
+  int start=mammut_min(job->n,worker*per);
+  int end=mammut_min(job->n,start+per);
+  int ch;
+
+  for (ch=0; ch<job->channels; ch++) {
+    spectrum_t *a=lyd+ch*N+2*start;
+    const spectrum_t *b=partner+ch*job->N2+2*start;
+    int done=0;
+
+    if (job->kernel!=NULL)
+      done=job->kernel(a,b,end-start,job->scale);
+    job->func(a+2*done,b+2*done,end-start-done,job->scale);
+  }
+}
+
+/* The SIMD kernel of the method, for the widest instruction set the cpu
+   has. A^B has none, since its time goes to powf. */
+static multiply_kernel multiply_findkernel(multiply_func func){
+#ifdef FFT_SIMD
+  int level=fft_simd_level();
+
+  if (func==multiply_convolve)
+    return level==FFT_SIMD_AVX512 ? multiply_convolve_avx512 : level==FFT_SIMD_AVX2 ? multiply_convolve_avx2 : level==FFT_SIMD_SSE2 ? multiply_convolve_sse2 : NULL;
+  if (func==multiply_correlate)
+    return level==FFT_SIMD_AVX512 ? multiply_correlate_avx512 : level==FFT_SIMD_AVX2 ? multiply_correlate_avx2 : level==FFT_SIMD_SSE2 ? multiply_correlate_sse2 : NULL;
+  if (func==multiply_fun)
+    return level==FFT_SIMD_AVX512 ? multiply_fun_avx512 : level==FFT_SIMD_AVX2 ? multiply_fun_avx2 : level==FFT_SIMD_SSE2 ? multiply_fun_sse2 : NULL;
+  if (func==multiply_phase_amp)
+    return level==FFT_SIMD_AVX512 ? multiply_phase_amp_avx512 : level==FFT_SIMD_AVX2 ? multiply_phase_amp_avx2 : level==FFT_SIMD_SSE2 ? multiply_phase_amp_sse2 : NULL;
+#endif
+  return NULL;
+}
+
+
 static char *das_load_and_multiply_ok(char *filename)
 {
 
-  int i, N2, framecnt2, method=0, samps_per_frame2,ch;
-  float r1, r2, i1, i2, amp,phi;
-  int progral;
+  int N2, framecnt2, samps_per_frame2;
+  multiply_func method=NULL;
+  struct multiply_job job;
   struct LoadStruct ls={0};
 
   SNDFILE *infile;
 
   if (N==0) return "Must first load file";
 
-  if (loadandmultiply_convolve) method=1;
-  else if (loadandmultiply_correlate) method=2;
-  else if (loadandmultiply_fun) method=3;
-  else if (loadandmultiply_a_b) method=4;
-  else if (loadandmultiply_phase_amp) method=5;
+  if (loadandmultiply_convolve) method=multiply_convolve;
+  else if (loadandmultiply_correlate) method=multiply_correlate;
+  else if (loadandmultiply_fun) method=multiply_fun;
+  else if (loadandmultiply_a_b) method=multiply_a_b;
+  else if (loadandmultiply_phase_amp) method=multiply_phase_amp;
 
   //  infile=afOpenFile(filename, "rb", in_AFsetup);
   infile=sf_open_read(filename,&ls.sfinfo);
@@ -53,63 +248,55 @@ static char *das_load_and_multiply_ok(char *filename)
   }
   */
 
-  N2=1;
-  while (N2<framecnt2) N2*=2;
+  N2=fft_fastsize(framecnt2);
   if (N2<N) N2=N;
-  if (lyd2!=NULL) free(lyd2);
-  lyd2=NULL;
-  fvec(lyd2, N2*samps_per_frame2);
 
-  readsound(&ls, lyd2, samps_per_frame2);
-  sf_close(infile);
+  if (partner_is(filename,N2,samps_per_frame2)==false) {
+    struct SpecCacheKey key;
+    bool usekey;
+
+    partner_free();
+    partner=BIGMEM_alloc(N2*samps_per_frame2);
+    if (partner==NULL) {
+      sf_close(infile);
+      return "Not enough memory or temporary disk space";
+    }
+
+    usekey=SPECCACHE_makeKey(&key,filename,&ls.sfinfo,N2,partner_dobler(N2,framecnt2));
+    if (usekey==false || SPECCACHE_load(&key,partner)==false) {
+      if (analyzesound(&ls, filename, partner, N2)==false) {
+	sf_close(infile);
+	partner_free();
+	return "Not enough memory";
+      }
+      if (usekey==true)
+	SPECCACHE_store(&key,partner);
+    }
 
-  for (ch=0; ch<samps_per_frame; ch++) {
-    GUI_aboveprogressbar(ch,samps_per_frame);
-    rfft(lyd2+N2*ch,  N2/2,  FORWARD);
+    strncpy(partner_filename,filename,sizeof(partner_filename)-1);
+    partner_filename[sizeof(partner_filename)-1]=0;
+    partner_mtimeOf(filename,&partner_mtime);
+    partner_N=N2;
+    partner_fastsize=fft_fastsize(framecnt2);
+    partner_channels=samps_per_frame2;
   }
+  sf_close(infile);
 
   
   //GUI_startprogressbar(0,&progval,1000*log(ND*2));
 
-  for (ch=0; ch<samps_per_frame; ch++) {
-    for (i=0; i<(N2>N?N:N2)/2; i++) {
-      r1=lyd[i+i+ch*N]; r2=lyd2[i+i+ch*N2];
-      i1=lyd[i+i+1+ch*N]; i2=lyd2[i+i+1+ch*N2];
-      switch (method) {
-        case 1:
-          lyd[i+i+ch*N]=(r1*r2-i1*i2)*N/1024;
-          lyd[i+i+1+ch*N]=(i1*r2+r1*i2)*N/1024;
-          break;
-        case 2:
-          lyd[i+i+ch*N]=(r1*r2+i1*i2)*N/1024;
-          lyd[i+i+1+ch*N]=(i1*r2-r1*i2)*N/1024;
-          break;
-        case 3:
-          lyd[i+i+ch*N]=(r1*r2-i1*r1)*N/1024;
-          lyd[i+i+1+ch*N]=(i1*r2+r1*i2)*N/1024;
-          break;
-        case 4:
-          amp=sqrt(r2*r2+i2*i2)+1.;
-          lyd[i+i+ch*N]=copysign(powf(fabs(lyd[i+i+ch*N]), amp), lyd[i+i+ch*N]);
-          lyd[i+i+1+ch*N]=copysign(powf(fabs(lyd[i+i+1+ch*N]), amp), lyd[i+i+1+ch*N]);
-          break;
-	case 5:
-	  amp=sqrt(r1*r1+i1*i1);
-	  phi=atan2(i2,r2);
-	  lyd[i+i+ch*N]=amp*cos(phi);
-	  lyd[i+i+1+ch*N]=amp*sin(phi);
-	  break;
-      }
-    }
+  if (method!=NULL) {
+    job.func=method;
+    job.kernel=multiply_findkernel(method);
+    job.channels=samps_per_frame;
+    job.n=N/2;
+    job.N2=N2;
+    job.scale=(spectrum_t)N/1024;
+    WORKERS_run(multiply_job,&job,mammut_max(1,mammut_min(WORKERS_getNum(),job.n/MULTIPLY_MIN_PER_WORKER)));
   }
 
-
   strcpy(playfile, filename);
 
-  free(lyd2);
-  lyd2=NULL;
-  fvec(lyd2, N*samps_per_frame);
-
   return NULL;
 }
 
@@ -122,8 +309,11 @@ void das_das_load_and_multiply_ok(void){
 
 char *load_and_multiply_ok(char *filename){
   das_filename=filename;
+  MC_spectrumChanging();
   GUI_newprocess(das_das_load_and_multiply_ok);
   RedrawWin();
+  if(das_ret==NULL)
+    RENDER_speculate();
   return das_ret;
 }
 
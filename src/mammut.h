@@ -24,6 +24,22 @@ extern LANGSPEC int theheight;
 #include "c_interface.h"
 
 #define mammut_min(a,b) (((a)<(b))?(a):(b))
+#define mammut_max(a,b) (((a)>(b))?(a):(b))
+
+
+/* The type of the spectrum, lyd and lyd2. Compiling with -DMAMMUT_DOUBLE
+   (see Makefile.linux) makes the analysis, the fft and the transforms use
+   double precision. That lowers the noise floor for very long sounds,
+   but uses twice the memory. */
+#ifdef MAMMUT_DOUBLE
+typedef double spectrum_t;
+#  define sf_readf_spectrum sf_readf_double
+#  define sf_writef_spectrum sf_writef_double
+#else
+typedef float spectrum_t;
+#  define sf_readf_spectrum sf_readf_float
+#  define sf_writef_spectrum sf_writef_float
+#endif
 
 
 /* Following code copied from Ceres. */
@@ -31,6 +47,8 @@ extern LANGSPEC int theheight;
 struct LoadStruct{
   SNDFILE *infile;
   SF_INFO sfinfo;  
+  struct MapSound *map; /* If not NULL, readsound reads from here instead of infile. (see mapsound.h) */
+  volatile bool *cancel; /* If not NULL, readsound gives up when it becomes true. */
 };
 
 
@@ -85,7 +103,7 @@ extern LANGSPEC int compression,  filefmt,  bits_per_samp,  samp_type;
 extern LANGSPEC int vers;
 extern LANGSPEC long framecnt, N;
 
-extern LANGSPEC float *lyd, *lyd2;
+extern LANGSPEC spectrum_t *lyd, *lyd2;
 
 extern LANGSPEC float duration;		    /* Duration in secs */
 extern LANGSPEC int numchannels;	    /* Number of FFT channels */
@@ -100,38 +118,58 @@ extern LANGSPEC bool prefs_picture;
 extern LANGSPEC bool prefs_animation;
 extern LANGSPEC bool prefs_movingcamera;
 extern LANGSPEC bool prefs_loop;
+extern LANGSPEC int prefs_fftthreads;
+extern LANGSPEC int prefs_speccache_mb;
+extern LANGSPEC int prefs_save_samplerate;
 
 extern LANGSPEC bool isprocessing;
 
-extern LANGSPEC void rfft(float x[], int N, int forward);
-void bitreverse(float x[], int N);
+extern LANGSPEC void fft_init(void);
+extern LANGSPEC long fft_fastsize(long n);
+extern LANGSPEC void rfft(spectrum_t x[], int N, int forward);
+extern LANGSPEC void rfft_channels(spectrum_t x[], int N, int channels, int forward);
+extern LANGSPEC void rfft_channels_forward_pruned(spectrum_t x[], int N, int channels, int nonzero, bool inorder);
+
+#define FFT_INPUTORDER_MAXFACTORS 32
+struct fft_inputorder{
+  int num;
+  int f[FFT_INPUTORDER_MAXFACTORS];
+  int weight[FFT_INPUTORDER_MAXFACTORS];
+  int digit[FFT_INPUTORDER_MAXFACTORS];
+  int pos;
+};
+extern LANGSPEC void fft_inputorder_init(struct fft_inputorder *o, const spectrum_t x[], int N, int nonzero);
+extern LANGSPEC int fft_inputorder_next(struct fft_inputorder *o);
+extern LANGSPEC void fft_inputorder_seek(struct fft_inputorder *o, int n);
+void bitreverse(spectrum_t x[], int N);
 char *loadana(char *filename);
-
-void SaveWaveConsumer(
-		      void *outfile,
-		      float **samples,
-		      int num_samples
-		      );
-
-void writesound(
-		void (*WaveConsumer)(
-				void *pointer,
-				float **samples,
-				int num_samples
-				),
-		void *pointer
-		);
+void load_and_multiply_newsize(void);
+
+/* Writes sound (length frames of each channel after each other) to
+   outfile, whose sample format is format, normalized if normalize is
+   true. If progress is not NULL, it is set to how much has been written,
+   from 0 to 1, for showing while another thread saves. Returns false if
+   not all of it could be written. (see save.c) */
+bool writesound(const spectrum_t *sound,long length,int channels,bool normalize,SNDFILE *outfile,int format,float *progress);
+
+/* Like writesound, but writes a new FLAC file named filename, encoding
+   segments of the sound on all CPUs at the same time. (see save.c) */
+bool writesound_flac(const spectrum_t *sound,long length,int channels,bool normalize,const char *filename,int format,int samplerate,float *progress);
 		
 void PlayStopHard(void);
 void Play(void);
 
-void readsound(struct LoadStruct *ls,float *ly, int spf);
+bool readsound(struct LoadStruct *ls,spectrum_t *ly, int spf, long length, bool fftorder);
+bool analyzesound(struct LoadStruct *ls,const char *filename,spectrum_t *ly,long length);
 
 
+/* Starts saving the sound in the background. (see export.h) Returns an
+   error message if the file could not be opened. */
 char *SaveOk(char *filename);
 
-extern LANGSPEC float get_normalize_val(void);
-extern LANGSPEC void normalize(void);
+/* sound holds length frames of each channel after each other, like lyd
+   after the inverse fft. */
+extern LANGSPEC float get_normalize_val(const spectrum_t *sound,long length,int channels);
 
 
 #define int_progval() int progvalval=0;int *volatile progval=&progvalval
@@ -139,11 +177,15 @@ extern LANGSPEC void normalize(void);
 
 //#ifdef __cplusplus
 extern LANGSPEC void GUI_aboveprogressbar(int curr,int maxvalue);
+extern LANGSPEC void GUI_progressmessage(const char *message);
 extern LANGSPEC void GUI_progressbar(int minvalue,int newvalue,int maxvalue);
 extern LANGSPEC void GUI_startprogressbar(int minvalue,int *valtocheck,int maxvalue);
 extern LANGSPEC void GUI_stopprogressbar(void);
 extern LANGSPEC void GUI_newprocess(void das_func(void));
 
+/* Shows the window with the saves going on in the background. */
+extern LANGSPEC void GUI_showexports(void);
+
 extern LANGSPEC void GUI_addUndo(void);
 extern LANGSPEC void RedrawWin(void);
 //#endif
@@ -0,0 +1,372 @@
+#include "mammut.h"
+#include "mapsound.h"
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#endif
+
+
+enum{
+  MAPSOUND_INT16,
+  MAPSOUND_INT24,
+  MAPSOUND_INT32,
+  MAPSOUND_FLOAT,
+  MAPSOUND_DOUBLE
+};
+
+struct MapSound{
+  const unsigned char *mem;
+  size_t size;
+
+  const unsigned char *data;
+  long frames;
+  int channels;
+  int type;
+  int bytes;
+  bool bigendian;
+
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+};
+
+
+
+/* Headers */
+
+static unsigned int MAPSOUND_le16(const unsigned char *p){
+  return p[0] | (p[1]<<8);
+}
+static unsigned int MAPSOUND_le32(const unsigned char *p){
+  return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+static unsigned int MAPSOUND_be16(const unsigned char *p){
+  return (p[0]<<8) | p[1];
+}
+static unsigned int MAPSOUND_be32(const unsigned char *p){
+  return ((unsigned int)p[0]<<24) | (p[1]<<16) | (p[2]<<8) | p[3];
+}
+
+
+/* Sets map->data to the start of the samples, or NULL if the header is
+   not understood. */
+static void MAPSOUND_findWav(struct MapSound *map){
+  const unsigned char *p=map->mem+12;
+  const unsigned char *end=map->mem+map->size;
+  bool fmt=false;
+
+  if(map->size<12 || memcmp(map->mem,"RIFF",4)!=0 || memcmp(map->mem+8,"WAVE",4)!=0)
+    return;
+
+  while(p+8<=end){
+    size_t size=MAPSOUND_le32(p+4);
+
+    if(memcmp(p,"fmt ",4)==0){
+      unsigned int tag;
+      if(size<16 || p+8+16>end)
+	return;
+      tag=MAPSOUND_le16(p+8);
+      if(tag==0xfffe){
+	if(size<26 || p+8+26>end)
+	  return;
+	tag=MAPSOUND_le16(p+8+24);
+      }
+      if(tag!=1 && tag!=3)
+	return;
+      if(MAPSOUND_le16(p+8+2)!=(unsigned int)map->channels
+	 || MAPSOUND_le16(p+8+12)!=(unsigned int)(map->channels*map->bytes)
+	 || MAPSOUND_le16(p+8+14)!=(unsigned int)(8*map->bytes)
+	 || (tag==3) != (map->type==MAPSOUND_FLOAT || map->type==MAPSOUND_DOUBLE))
+	return;
+      fmt=true;
+    }
+
+    if(memcmp(p,"data",4)==0){
+      if(fmt==true)
+	map->data=p+8;
+      return;
+    }
+
+    p+=8+size+(size&1);
+  }
+}
+
+static void MAPSOUND_findAiff(struct MapSound *map){
+  const unsigned char *p=map->mem+12;
+  const unsigned char *end=map->mem+map->size;
+  bool aifc;
+  bool comm=false;
+
+  if(map->size<12 || memcmp(map->mem,"FORM",4)!=0)
+    return;
+  if(memcmp(map->mem+8,"AIFF",4)==0)
+    aifc=false;
+  else if(memcmp(map->mem+8,"AIFC",4)==0)
+    aifc=true;
+  else
+    return;
+
+  map->bigendian=true;
+
+  while(p+8<=end){
+    size_t size=MAPSOUND_be32(p+4);
+
+    if(memcmp(p,"COMM",4)==0){
+      if(size<18 || p+8+18>end)
+	return;
+      if(MAPSOUND_be16(p+8)!=(unsigned int)map->channels
+	 || MAPSOUND_be16(p+8+6)!=(unsigned int)(8*map->bytes))
+	return;
+      if(aifc==true){
+	const unsigned char *compression=p+8+18;
+	if(size<22 || compression+4>end)
+	  return;
+	if(memcmp(compression,"sowt",4)==0)
+	  map->bigendian=false;
+	else if(memcmp(compression,"NONE",4)!=0 && memcmp(compression,"twos",4)!=0
+		&& memcmp(compression,"fl32",4)!=0 && memcmp(compression,"FL32",4)!=0
+		&& memcmp(compression,"fl64",4)!=0 && memcmp(compression,"FL64",4)!=0)
+	  return;
+      }
+      comm=true;
+    }
+
+    if(memcmp(p,"SSND",4)==0){
+      if(comm==true && p+16<=end)
+	map->data=p+16+MAPSOUND_be32(p+8);
+      return;
+    }
+
+    p+=8+size+(size&1);
+  }
+}
+
+
+
+/* Mapping */
+
+#ifdef _WIN32
+
+static bool MAPSOUND_map(struct MapSound *map,const char *filename){
+  LARGE_INTEGER size;
+
+  map->file=CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+			FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+  if(map->file==INVALID_HANDLE_VALUE)
+    return false;
+
+  if(GetFileSizeEx(map->file,&size)==0 || size.QuadPart==0 || (unsigned long long)size.QuadPart>SIZE_MAX){
+    CloseHandle(map->file);
+    return false;
+  }
+  map->size=(size_t)size.QuadPart;
+
+  map->mapping=CreateFileMappingA(map->file,NULL,PAGE_READONLY,0,0,NULL);
+  if(map->mapping==NULL){
+    CloseHandle(map->file);
+    return false;
+  }
+
+  map->mem=(const unsigned char*)MapViewOfFile(map->mapping,FILE_MAP_READ,0,0,0);
+  if(map->mem==NULL){
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+    return false;
+  }
+  return true;
+}
+
+static void MAPSOUND_unmap(struct MapSound *map){
+  UnmapViewOfFile(map->mem);
+  CloseHandle(map->mapping);
+  CloseHandle(map->file);
+}
+
+#else
+
+static bool MAPSOUND_map(struct MapSound *map,const char *filename){
+  struct stat st;
+  void *mem;
+  int fd;
+
+  fd=open(filename,O_RDONLY);
+  if(fd==-1)
+    return false;
+
+  if(fstat(fd,&st)!=0 || st.st_size==0 || (unsigned long long)st.st_size>SIZE_MAX){
+    close(fd);
+    return false;
+  }
+  map->size=(size_t)st.st_size;
+
+  mem=mmap(NULL,map->size,PROT_READ,MAP_SHARED,fd,0);
+  close(fd);
+  if(mem==MAP_FAILED)
+    return false;
+
+  madvise(mem,map->size,MADV_SEQUENTIAL);
+  map->mem=(const unsigned char*)mem;
+  return true;
+}
+
+static void MAPSOUND_unmap(struct MapSound *map){
+  munmap((void*)map->mem,map->size);
+}
+
+#endif
+
+
+
+struct MapSound *MAPSOUND_open(const char *filename,const SF_INFO *sfinfo){
+#ifdef SNDFILE_0
+  return NULL;
+#else
+  struct MapSound *map;
+  int major=sfinfo->format&SF_FORMAT_TYPEMASK;
+
+  if(major!=SF_FORMAT_WAV && major!=SF_FORMAT_AIFF && major!=SF_FORMAT_RAW)
+    return NULL;
+  if(sfinfo->channels<1 || sfinfo->frames<1)
+    return NULL;
+
+  map=calloc(1,sizeof(struct MapSound));
+  if(map==NULL)
+    return NULL;
+
+  map->channels=sfinfo->channels;
+  map->frames=(long)sfinfo->frames;
+
+  switch(sfinfo->format&SF_FORMAT_SUBMASK){
+  case SF_FORMAT_PCM_16: map->type=MAPSOUND_INT16; map->bytes=2; break;
+  case SF_FORMAT_PCM_24: map->type=MAPSOUND_INT24; map->bytes=3; break;
+  case SF_FORMAT_PCM_32: map->type=MAPSOUND_INT32; map->bytes=4; break;
+  case SF_FORMAT_FLOAT: map->type=MAPSOUND_FLOAT; map->bytes=4; break;
+  case SF_FORMAT_DOUBLE: map->type=MAPSOUND_DOUBLE; map->bytes=8; break;
+  default:
+    free(map);
+    return NULL;
+  }
+
+  if(MAPSOUND_map(map,filename)==false){
+    free(map);
+    return NULL;
+  }
+
+  if(major==SF_FORMAT_WAV)
+    MAPSOUND_findWav(map);
+  else if(major==SF_FORMAT_AIFF)
+    MAPSOUND_findAiff(map);
+  else{
+    map->data=map->mem;
+    map->bigendian=(sfinfo->format&SF_FORMAT_ENDMASK)==SF_ENDIAN_BIG;
+  }
+
+  /* Everything libsndfile says is there must also be in the file. */
+  if(map->data==NULL
+     || map->data<map->mem
+     || (size_t)(map->data-map->mem) > map->size
+     || (map->size-(size_t)(map->data-map->mem))/((size_t)map->channels*map->bytes) < (size_t)map->frames)
+  {
+    MAPSOUND_close(map);
+    return NULL;
+  }
+
+  return map;
+#endif
+}
+
+void MAPSOUND_close(struct MapSound *map){
+  if(map==NULL)
+    return;
+  if(map->mem!=NULL)
+    MAPSOUND_unmap(map);
+  free(map);
+}
+
+
+
+/* Conversion. One loop for each format and byte order, with the bytes put
+   together by hand, which the compiler turns into plain (vector) loads
+   when the byte order is the same as the cpu's. */
+
+#define MAPSOUND_LOOP(expr)				\
+  for(i=0;i<num;i++,p+=step){				\
+    out[i]=(expr);					\
+  }
+
+void MAPSOUND_read(const struct MapSound *map,int ch,long frame,int num,spectrum_t *out){
+  const size_t step=(size_t)map->channels*map->bytes;
+  const unsigned char *p=map->data + (size_t)frame*step + (size_t)ch*map->bytes;
+  int i;
+
+  switch(map->type){
+  case MAPSOUND_INT16:
+    if(map->bigendian){
+      MAPSOUND_LOOP((int16_t)((p[0]<<8)|p[1]) * (spectrum_t)(1.0/0x8000));
+    }else{
+      MAPSOUND_LOOP((int16_t)(p[0]|(p[1]<<8)) * (spectrum_t)(1.0/0x8000));
+    }
+    break;
+  case MAPSOUND_INT24:
+    if(map->bigendian){
+      MAPSOUND_LOOP((int32_t)(((uint32_t)p[0]<<24)|(p[1]<<16)|(p[2]<<8)) * (spectrum_t)(1.0/0x80000000));
+    }else{
+      MAPSOUND_LOOP((int32_t)(((uint32_t)p[2]<<24)|(p[1]<<16)|(p[0]<<8)) * (spectrum_t)(1.0/0x80000000));
+    }
+    break;
+  case MAPSOUND_INT32:
+    if(map->bigendian){
+      MAPSOUND_LOOP((int32_t)MAPSOUND_be32(p) * (spectrum_t)(1.0/0x80000000));
+    }else{
+      MAPSOUND_LOOP((int32_t)MAPSOUND_le32(p) * (spectrum_t)(1.0/0x80000000));
+    }
+    break;
+  case MAPSOUND_FLOAT:
+    for(i=0;i<num;i++,p+=step){
+      uint32_t u=map->bigendian ? MAPSOUND_be32(p) : MAPSOUND_le32(p);
+      float f;
+      memcpy(&f,&u,sizeof(float));
+      out[i]=f;
+    }
+    break;
+  case MAPSOUND_DOUBLE:
+    for(i=0;i<num;i++,p+=step){
+      uint64_t u= map->bigendian
+	? ((uint64_t)MAPSOUND_be32(p)<<32) | MAPSOUND_be32(p+4)
+	: ((uint64_t)MAPSOUND_le32(p+4)<<32) | MAPSOUND_le32(p);
+      double d;
+      memcpy(&d,&u,sizeof(double));
+      out[i]=d;
+    }
+    break;
+  }
+}
+
+#undef MAPSOUND_LOOP
+
+
+void MAPSOUND_prefetch(const struct MapSound *map,long frame,int num){
+#ifndef _WIN32
+  const size_t step=(size_t)map->channels*map->bytes;
+  size_t pagesize=(size_t)sysconf(_SC_PAGESIZE);
+  size_t start,end;
+
+  if(frame>=map->frames)
+    return;
+  num=(int)mammut_min((long)num,map->frames-frame);
+
+  start=(size_t)(map->data-map->mem) + (size_t)frame*step;
+  end=start+(size_t)num*step;
+  start-=start%pagesize;
+
+  madvise((void*)(map->mem+start),end-start,MADV_WILLNEED);
+#endif
+}
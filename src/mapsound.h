@@ -0,0 +1,23 @@
+
+/* Reading uncompressed sound files (WAV, AIFF and RAW with 16, 24 or 32
+   bit integers, or floats) straight from the file mapped into memory,
+   instead of through libsndfile. Saves a copy and a conversion in
+   libsndfile for every sample, and the system calls, which matters for
+   sounds of several gigabytes.
+
+   The file must already be opened with libsndfile, which is used for
+   everything else, and to find out what sort of file it is. */
+
+/* Returns NULL if the file is not one of the formats above, or can not be
+   mapped. Readsound uses libsndfile in that case. */
+extern LANGSPEC struct MapSound *MAPSOUND_open(const char *filename,const SF_INFO *sfinfo);
+
+extern LANGSPEC void MAPSOUND_close(struct MapSound *map);
+
+/* Puts num frames of channel ch, starting at frame, into out, scaled the
+   same way sf_readf_float does. */
+extern LANGSPEC void MAPSOUND_read(const struct MapSound *map,int ch,long frame,int num,spectrum_t *out);
+
+/* Tells the system that the frames will soon be read, so that it can
+   start reading them from the disk in the background. */
+extern LANGSPEC void MAPSOUND_prefetch(const struct MapSound *map,long frame,int num);
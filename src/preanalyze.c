@@ -0,0 +1,170 @@
+#include "mammut.h"
+#include "workers.h"
+#include "bigmem.h"
+#include "speccache.h"
+#include "preanalyze.h"
+
+
+#define PREANALYZE_MAXFILES 8
+
+
+static struct WORKERS_Lock *lock;
+
+/* The rest is protected by lock, except cancel, which is only set. */
+static struct WORKERS_Thread *thread=NULL;
+static bool running=false;
+static volatile bool cancel=false;
+
+static char *files[PREANALYZE_MAXFILES];
+static int analyzed[PREANALYZE_MAXFILES]; /* The duration doubling it was analyzed for, or -1. */
+static int num_files=0;
+
+
+
+/* Does the same as das_loadana, except for the ending up in lyd. Returns
+   false if cancelled. */
+static bool PREANALYZE_file(const char *filename,int das_dobler)
+{
+  struct LoadStruct ls;
+  struct SpecCacheKey key;
+  spectrum_t *ly;
+  long length;
+  int i;
+
+  memset(&ls,0,sizeof(ls));
+  ls.cancel=&cancel;
+  ls.infile=sf_open_read(filename,&ls.sfinfo);
+  if(ls.infile==NULL)
+    return true;
+
+  length=fft_fastsize(ls.sfinfo.MSF_FRAMENAME);
+  for(i=0;i<das_dobler;i++)
+    length*=2;
+
+  if(SPECCACHE_makeKey(&key,filename,&ls.sfinfo,length,das_dobler)==false
+     || cancel==true
+     || SPECCACHE_has(&key)==true
+     || BIGMEM_hasRoom((size_t)length*ls.sfinfo.channels)==false)
+  {
+    sf_close(ls.infile);
+    return cancel==false;
+  }
+
+  /* From BIGMEM, so that a load in the foreground sees the memory as
+     taken. It is not worth analyzing in a temporary file. */
+  ly=BIGMEM_alloc((size_t)length*ls.sfinfo.channels);
+  if(ly==NULL || BIGMEM_isOnDisk(ly)==true){
+    BIGMEM_free(ly);
+    sf_close(ls.infile);
+    return true;
+  }
+
+  if(analyzesound(&ls,filename,ly,length)==true && cancel==false)
+    SPECCACHE_store(&key,ly);
+
+  BIGMEM_free(ly);
+  sf_close(ls.infile);
+
+  return cancel==false;
+}
+
+
+static void PREANALYZE_thread(void *arg)
+{
+  for(;;){
+    char *filename=NULL;
+    int das_dobler=dobler;
+    int i;
+
+    WORKERS_lock(lock);
+    for(i=0;cancel==false && i<num_files;i++)
+      if(analyzed[i]!=das_dobler){
+	filename=strdup(files[i]);
+	analyzed[i]=das_dobler;
+	break;
+      }
+    if(filename==NULL){
+      running=false;
+      WORKERS_unlock(lock);
+      return;
+    }
+    WORKERS_unlock(lock);
+
+    if(PREANALYZE_file(filename,das_dobler)==false){
+      WORKERS_lock(lock);
+      for(i=0;i<num_files;i++)
+	if(!strcmp(files[i],filename))
+	  analyzed[i]=-1;
+      WORKERS_unlock(lock);
+    }
+
+    free(filename);
+  }
+}
+
+
+/* Must be called with lock held. */
+static void PREANALYZE_startThread(void)
+{
+  cancel=false;
+
+  if(running==true || num_files==0 || prefs_speccache_mb<=0)
+    return;
+
+  /* A thread that is not running has returned, or is just about to. */
+  if(thread!=NULL)
+    WORKERS_waitThread(thread);
+
+  running=true;
+  thread=WORKERS_startBackgroundThread(PREANALYZE_thread,NULL);
+}
+
+
+
+void PREANALYZE_init(void)
+{
+  lock=WORKERS_newLock();
+}
+
+void PREANALYZE_start(const char *const *filenames,int num)
+{
+  char *new_files[PREANALYZE_MAXFILES];
+  int new_analyzed[PREANALYZE_MAXFILES];
+  int i,j;
+
+  num=mammut_min(num,PREANALYZE_MAXFILES);
+
+  WORKERS_lock(lock);
+
+  for(i=0;i<num;i++){
+    new_files[i]=strdup(filenames[i]);
+    new_analyzed[i]=-1;
+    for(j=0;j<num_files;j++)
+      if(!strcmp(files[j],filenames[i]))
+	new_analyzed[i]=analyzed[j];
+  }
+
+  for(j=0;j<num_files;j++)
+    free(files[j]);
+  for(i=0;i<num;i++){
+    files[i]=new_files[i];
+    analyzed[i]=new_analyzed[i];
+  }
+  num_files=num;
+
+  PREANALYZE_startThread();
+
+  WORKERS_unlock(lock);
+}
+
+void PREANALYZE_stop(void)
+{
+  cancel=true;
+}
+
+void PREANALYZE_resume(void)
+{
+  WORKERS_lock(lock);
+  PREANALYZE_startThread();
+  WORKERS_unlock(lock);
+}
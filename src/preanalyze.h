@@ -0,0 +1,21 @@
+
+/* Analysis of recently used sounds in the background, when mammut is
+   otherwise idle, so that switching between them only has to read their
+   spectra back from the spectrum cache. (see speccache.h)
+
+   One sound is analyzed at a time, in a thread of the lowest priority
+   that does not use the worker threads. Sounds whose spectrum would not
+   fit in the memory left for spectra (see BIGMEM_hasRoom) are skipped. */
+
+extern LANGSPEC void PREANALYZE_init(void);
+
+/* Sets the sounds to analyze, most likely next first, and starts
+   analyzing them. Sounds already in the cache are skipped. */
+extern LANGSPEC void PREANALYZE_start(const char *const *filenames,int num);
+
+/* Called when the user starts something. The sound being analyzed is
+   given up as soon as possible, without waiting for it. */
+extern LANGSPEC void PREANALYZE_stop(void);
+
+/* Continues with the sounds from the last PREANALYZE_start. */
+extern LANGSPEC void PREANALYZE_resume(void);
@@ -0,0 +1,464 @@
+#include "mammut.h"
+#include "workers.h"
+#include "bigmem.h"
+#include "resample.h"
+#include "render.h"
+
+
+#define RENDER_MAXTHREADS 64
+#define RENDER_MAXHOLDS 8
+
+
+static struct WORKERS_Lock *lock;
+
+/* Counted up by RENDER_changed, and by RENDER_begin when the cache is
+   set up anew. A thread only makes channels of the generation it was
+   started for. Protected by lock. */
+static unsigned int generation=0;
+
+/* The cached sound, and what it is made from. Set by RENDER_begin. The
+   threads of older generations may still be running then, but they no
+   longer touch the cache. After that only next_channel, channels_done,
+   cache.normalize_val and ready change, which are protected by lock. */
+static struct RenderSound cache={0};
+static size_t cache_size=0;
+static bool cache_islyd2=false; /* Made in lyd2 when there was no room for it. */
+static unsigned int cache_generation;
+static int cache_askedrate; /* cache.rate is the rate it got. */
+static const spectrum_t *cache_spectrum;
+static long cache_N;
+static int cache_R;
+static int cache_channels;
+static long cache_worksize; /* 0 if made at the rate of the spectrum. */
+static int next_channel;
+static int channels_done;
+static bool ready=false;
+
+static int last_rate=0;
+
+/* Called when the cache is ready. (see RENDER_start) Protected by lock. */
+static void (*notify)(const struct RenderSound *sound)=NULL;
+
+/* Signalled each time a channel is finished. */
+static struct WORKERS_Event *channeldone;
+
+/* The threads making channels in the background. Each has memory of its
+   own for the channel it makes, so that RENDER_changed does not have to
+   wait for it. A channel finished after the spectrum changed is thrown
+   away. Only done is protected by lock. */
+struct RenderThread{
+  struct WORKERS_Thread *thread; /* NULL if the slot is free. */
+  unsigned int generation;
+  spectrum_t *channel; /* cache.length values */
+  spectrum_t *work; /* RESAMPLE_worksize values, or NULL */
+  bool done;
+};
+
+static struct RenderThread threads[RENDER_MAXTHREADS];
+
+/* Sounds held by RENDER_hold. A held sound is freed by the last
+   RENDER_release instead of by the cache. Protected by lock, and so is
+   cache.sound, which RENDER_release compares with. */
+static struct{
+  spectrum_t *sound;
+  int num;
+}holds[RENDER_MAXHOLDS];
+
+
+
+/* Must be called with lock held. */
+static bool RENDER_isCurrent(int rate)
+{
+  return cache.sound!=NULL && cache_generation==generation && cache_askedrate==rate;
+}
+
+/* Frees the slots of the threads that are finished, without waiting
+   for the others. */
+static void RENDER_reapThreads(void)
+{
+  int i;
+  for(i=0;i<RENDER_MAXTHREADS;i++){
+    bool done;
+    if(threads[i].thread==NULL)
+      continue;
+    WORKERS_lock(lock);
+    done=threads[i].done;
+    WORKERS_unlock(lock);
+    if(done==true){
+      WORKERS_waitThread(threads[i].thread);
+      threads[i].thread=NULL;
+    }
+  }
+}
+
+/* Returns the slot of sound in holds, or -1. NULL finds a free slot.
+   Must be called with lock held. */
+static int RENDER_findHold(const spectrum_t *sound)
+{
+  int i;
+  for(i=0;i<RENDER_MAXHOLDS;i++)
+    if(holds[i].sound==sound)
+      return i;
+  return -1;
+}
+
+static void RENDER_free(void)
+{
+  spectrum_t *sound;
+
+  WORKERS_lock(lock);
+  sound=cache.sound;
+  if(cache_islyd2==true || (sound!=NULL && RENDER_findHold(sound)>=0))
+    sound=NULL;
+  cache.sound=NULL;
+  ready=false;
+  WORKERS_unlock(lock);
+
+  BIGMEM_free(sound);
+  cache_size=0;
+  cache_islyd2=false;
+}
+
+
+/* Makes channels of the cache of generation gen until there are no more
+   left, or the spectrum is about to change. Only the copying in and out of
+   the cache is done with lock held. work is RESAMPLE_worksize values, or
+   NULL when the sound is made at the rate of the spectrum. If channel is
+   NULL, the sound is made straight into the cache, which only the thread
+   that would call RENDER_changed may do. */
+static void RENDER_work(unsigned int gen,spectrum_t *work,spectrum_t *channel)
+{
+  for(;;){
+    spectrum_t *x,*out;
+    long spectrumN,length;
+    int spectrumR,rate,channels;
+    float normalize_val;
+    int ch;
+
+    WORKERS_lock(lock);
+    if(gen!=generation || next_channel==cache_channels){
+      WORKERS_unlock(lock);
+      return;
+    }
+    ch=next_channel++;
+    spectrumN=cache_N;
+    spectrumR=cache_R;
+    rate=cache.rate;
+    length=cache.length;
+    channels=cache_channels;
+    out=channel!=NULL ? channel : cache.sound+ch*length;
+    x=work!=NULL ? work : out;
+    memcpy(x,cache_spectrum+ch*spectrumN,sizeof(spectrum_t)*spectrumN);
+    WORKERS_unlock(lock);
+
+    GUI_aboveprogressbar(ch,channels);
+
+    if(work!=NULL)
+      RESAMPLE_synthesizeChannel(x,spectrumN,spectrumR,rate,out);
+    else
+      rfft(x,spectrumN/2,INVERSE);
+
+    /* The normalize value of all the channels is the lowest of theirs. */
+    normalize_val=get_normalize_val(out,length,1);
+
+    WORKERS_lock(lock);
+    if(gen!=generation){
+      WORKERS_unlock(lock);
+      return;
+    }
+    if(channel!=NULL)
+      memcpy(cache.sound+ch*length,channel,sizeof(spectrum_t)*length);
+    if(channels_done==0 || normalize_val<cache.normalize_val)
+      cache.normalize_val=normalize_val;
+    if(++channels_done==cache_channels){
+      ready=true;
+      if(notify!=NULL)
+	notify(&cache);
+      notify=NULL;
+    }
+    WORKERS_unlock(lock);
+
+    WORKERS_signalEvent(channeldone);
+  }
+}
+
+static void RENDER_thread(void *arg)
+{
+  struct RenderThread *thread=arg;
+
+  RENDER_work(thread->generation,thread->work,thread->channel);
+  BIGMEM_free(thread->work);
+  BIGMEM_free(thread->channel);
+
+  WORKERS_lock(lock);
+  thread->done=true;
+  WORKERS_unlock(lock);
+}
+
+/* Starts up to num threads making the channels of the cache, in the
+   background, or for the user waiting for it. Returns how many could be
+   started. */
+static int RENDER_startThreads(int num,bool background)
+{
+  int started=0;
+  int i;
+
+  RENDER_reapThreads();
+
+  for(i=0;i<RENDER_MAXTHREADS && started<num;i++){
+    struct RenderThread *thread=&threads[i];
+    if(thread->thread!=NULL)
+      continue;
+
+    thread->channel=BIGMEM_alloc(cache.length);
+    thread->work=cache_worksize>0 ? BIGMEM_alloc(cache_worksize) : NULL;
+    if(thread->channel==NULL || (cache_worksize>0 && thread->work==NULL)){
+      BIGMEM_free(thread->channel);
+      BIGMEM_free(thread->work);
+      break;
+    }
+
+    thread->generation=cache_generation;
+    thread->done=false;
+    thread->thread=background==true ? WORKERS_startBackgroundThread(RENDER_thread,thread)
+      : WORKERS_startJobThread(RENDER_thread,thread);
+    started++;
+  }
+
+  return started;
+}
+
+
+/* Sets up the cache for the current spectrum at rate, for num_threads
+   threads. The threads of the last cache stop making it. In the
+   background, the memory must fit in memory, and the sound is never made
+   in lyd2, which the next transform might use. */
+static bool RENDER_begin(int rate,int num_threads,bool background)
+{
+  long length=N;
+  long worksize=0;
+  int newrate=R;
+  size_t size;
+  bool held;
+
+  WORKERS_lock(lock);
+  generation++;
+  WORKERS_unlock(lock);
+
+  if(rate!=R && RESAMPLE_possible(N,R,rate,&length)==true){
+    worksize=RESAMPLE_worksize(N,R,rate);
+    newrate=rate;
+  }
+  size=(size_t)length*samps_per_frame;
+
+  WORKERS_lock(lock);
+  held=cache.sound!=NULL && RENDER_findHold(cache.sound)>=0;
+  WORKERS_unlock(lock);
+
+  /* A held sound might be being saved, so it is not made again. */
+  if(cache_size!=size || cache_islyd2==true || held==true)
+    RENDER_free();
+
+  if(background==true
+     && BIGMEM_hasRoom((cache.sound==NULL ? size : 0) + (size_t)(length+worksize)*num_threads)==false)
+    return false;
+
+  if(cache.sound==NULL){
+    spectrum_t *sound;
+    if(background==false && worksize==0 && lyd2!=NULL && BIGMEM_hasRoom(size)==false){
+      sound=lyd2;
+      cache_islyd2=true;
+    }else
+      sound=BIGMEM_alloc(size);
+    if(sound==NULL)
+      return false;
+    WORKERS_lock(lock);
+    cache.sound=sound;
+    WORKERS_unlock(lock);
+    cache_size=size;
+  }
+
+  WORKERS_lock(lock);
+  cache_generation=generation;
+  cache_askedrate=rate;
+  cache.length=length;
+  cache.rate=newrate;
+  cache_spectrum=lyd;
+  cache_N=N;
+  cache_R=R;
+  cache_channels=samps_per_frame;
+  cache_worksize=worksize;
+  next_channel=0;
+  channels_done=0;
+  ready=false;
+  WORKERS_unlock(lock);
+
+  return true;
+}
+
+
+
+void RENDER_init(void)
+{
+  lock=WORKERS_newLock();
+  channeldone=WORKERS_newEvent();
+}
+
+void RENDER_changed(void)
+{
+  WORKERS_lock(lock);
+  generation++;
+  notify=NULL;
+  WORKERS_unlock(lock);
+
+  RENDER_reapThreads();
+  RENDER_free();
+}
+
+void RENDER_speculate(void)
+{
+  int rate=last_rate>0 ? last_rate : R;
+  int num;
+  bool current;
+
+  if(lyd==NULL || N==0)
+    return;
+
+  WORKERS_lock(lock);
+  current=RENDER_isCurrent(rate);
+  WORKERS_unlock(lock);
+  if(current==true)
+    return;
+
+  num=mammut_min(samps_per_frame,mammut_min(WORKERS_getNum(),RENDER_MAXTHREADS));
+
+  if(RENDER_begin(rate,num,true)==false)
+    return;
+
+  RENDER_startThreads(num,true);
+}
+
+bool RENDER_start(int rate,void (*ready_func)(const struct RenderSound *sound))
+{
+  bool current,left;
+
+  last_rate=rate;
+
+  WORKERS_lock(lock);
+  current=RENDER_isCurrent(rate);
+  WORKERS_unlock(lock);
+
+  if(current==false && RENDER_begin(rate,1,false)==false)
+    return false;
+
+  WORKERS_lock(lock);
+  if(ready==true)
+    ready_func(&cache);
+  else
+    notify=ready_func;
+  left=next_channel<cache_channels;
+  WORKERS_unlock(lock);
+
+  /* The channels already being made in the background are waited for. */
+  if(left==true && RENDER_startThreads(1,false)==0){
+    RENDER_stopNotify();
+    return false;
+  }
+
+  return true;
+}
+
+void RENDER_stopNotify(void)
+{
+  WORKERS_lock(lock);
+  notify=NULL;
+  WORKERS_unlock(lock);
+}
+
+bool RENDER_isReady(int rate)
+{
+  bool ret;
+
+  WORKERS_lock(lock);
+  ret=RENDER_isCurrent(rate) && ready==true;
+  WORKERS_unlock(lock);
+
+  return ret;
+}
+
+const struct RenderSound *RENDER_get(int rate)
+{
+  spectrum_t *work=NULL;
+  bool current;
+
+  last_rate=rate;
+
+  if(RENDER_isReady(rate)==true)
+    return &cache;
+
+  WORKERS_lock(lock);
+  current=RENDER_isCurrent(rate);
+  WORKERS_unlock(lock);
+
+  if(current==false && RENDER_begin(rate,0,false)==false)
+    return NULL;
+
+  if(cache_worksize>0)
+    work=BIGMEM_alloc(cache_worksize);
+
+  if(cache_worksize==0 || work!=NULL)
+    RENDER_work(cache_generation,work,NULL);
+
+  BIGMEM_free(work);
+
+  /* Waits for the channels the threads are making. */
+  WORKERS_lock(lock);
+  while(ready==false && next_channel==cache_channels){
+    WORKERS_unlock(lock);
+    WORKERS_waitEvent(channeldone);
+    WORKERS_lock(lock);
+  }
+  current=ready;
+  WORKERS_unlock(lock);
+
+  return current==true ? &cache : NULL;
+}
+
+bool RENDER_hold(int rate,struct RenderSound *sound)
+{
+  bool ret=false;
+  int i;
+
+  WORKERS_lock(lock);
+  if(RENDER_isCurrent(rate) && ready==true && cache_islyd2==false){
+    i=RENDER_findHold(cache.sound);
+    if(i==-1)
+      i=RENDER_findHold(NULL);
+    if(i>=0){
+      holds[i].sound=cache.sound;
+      holds[i].num++;
+      *sound=cache;
+      ret=true;
+    }
+  }
+  WORKERS_unlock(lock);
+
+  return ret;
+}
+
+void RENDER_release(const struct RenderSound *sound)
+{
+  spectrum_t *tofree=NULL;
+  int i;
+
+  WORKERS_lock(lock);
+  i=RENDER_findHold(sound->sound);
+  if(--holds[i].num==0){
+    holds[i].sound=NULL;
+    if(sound->sound!=cache.sound)
+      tofree=sound->sound;
+  }
+  WORKERS_unlock(lock);
+
+  BIGMEM_free(tofree);
+}
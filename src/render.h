@@ -0,0 +1,56 @@
+
+/* The sound made from the spectrum for playing, kept until the spectrum
+   changes, so that playing an unchanged spectrum again starts at once.
+
+   The cached sound belongs to an edit generation, which RENDER_changed
+   counts up. After a transform, RENDER_speculate makes the sound of the
+   new spectrum in the background, one channel in each thread of the
+   lowest priority, so that it is usually ready before play is pressed.
+   RENDER_get does what is left of it with the worker threads. */
+
+struct RenderSound{
+  spectrum_t *sound; /* length frames of each channel after each other */
+  long length;
+  int rate;
+  float normalize_val; /* see get_normalize_val */
+};
+
+extern LANGSPEC void RENDER_init(void);
+
+/* Must be called before lyd, N, R or samps_per_frame are changed. Frees
+   the cached sound at once. The background threads are not waited for,
+   and the channels they are making are thrown away. */
+extern LANGSPEC void RENDER_changed(void);
+
+/* Starts making the sound of the current spectrum in the background, at
+   the rate of the last RENDER_get, unless it is already made or would
+   not fit in memory. (see BIGMEM_hasRoom) */
+extern LANGSPEC void RENDER_speculate(void);
+
+/* Starts making the sound of the current spectrum at rate, like
+   RENDER_get, but in a thread of its own (see WORKERS_startJobThread) that
+   is never waited for. When the sound is ready, ready_func is called with
+   it, with a lock held, from whichever thread finished it. The sound is
+   then valid until RENDER_changed. Returns false if it could not be
+   started. */
+extern LANGSPEC bool RENDER_start(int rate,void (*ready_func)(const struct RenderSound *sound));
+
+/* Makes sure the ready_func of RENDER_start is not called any more.
+   RENDER_changed does the same. */
+extern LANGSPEC void RENDER_stopNotify(void);
+
+/* True if RENDER_get(rate) would return at once. */
+extern LANGSPEC bool RENDER_isReady(int rate);
+
+/* Returns the sound of the current spectrum, made at rate if the spectrum
+   can be converted to it (see resample.h), or else at R. Returns NULL if
+   there is no memory for it. The sound is valid until RENDER_changed. */
+extern LANGSPEC const struct RenderSound *RENDER_get(int rate);
+
+/* For keeping the sound after the spectrum has changed, such as while it
+   is saved in the background. (see export.h) If the sound of the current
+   spectrum is ready at rate, copies it to sound and returns true. The
+   sound is then valid until RENDER_release, which can be called from any
+   thread. Returns false if the sound is not ready, or was made in lyd2. */
+extern LANGSPEC bool RENDER_hold(int rate,struct RenderSound *sound);
+extern LANGSPEC void RENDER_release(const struct RenderSound *sound);
@@ -0,0 +1,182 @@
+#include "mammut.h"
+#include "bigmem.h"
+#include "resample.h"
+
+#include <limits.h>
+
+
+/* The sound (N frames) is padded to padded frames, which are made into
+   converted frames at the new rate, of which the first length are used. */
+struct ResamplePlan{
+  long N;
+  long padded;
+  long converted;
+  long length;
+};
+
+static bool RESAMPLE_smooth(long n){
+  static const int factors[]={2,3,5,7};
+  int i;
+  for(i=0;i<4;i++)
+    while(n%factors[i]==0)
+      n/=factors[i];
+  return n==1;
+}
+
+static long RESAMPLE_gcd(long a,long b){
+  while(b!=0){
+    long t=a%b;
+    a=b;
+    b=t;
+  }
+  return a;
+}
+
+static bool RESAMPLE_plan(long N,int R,int newR,struct ResamplePlan *plan){
+  long g,p,q,k;
+
+  if(N<2 || (N&1) || R<=0 || newR<=0)
+    return false;
+
+  g=RESAMPLE_gcd(R,newR);
+  p=newR/g;
+  q=R/g;
+
+  if((double)N*p > (double)LONG_MAX/4)
+    return false;
+
+  plan->N=N;
+  plan->length=(N*p+q-1)/q;
+
+  if((N*p)%q==0 && fft_fastsize(N*p/q)==N*p/q && N*p/q/2<=INT_MAX){
+    plan->padded=N;
+    plan->converted=N*p/q;
+    return true;
+  }
+
+  if(RESAMPLE_smooth(p)==false || RESAMPLE_smooth(q)==false)
+    return false;
+
+  /* k is even and has no larger prime factors, so both sizes are fast. */
+  k=fft_fastsize((N+q-1)/q);
+  plan->padded=q*k;
+  plan->converted=p*k;
+
+  /* rfft takes an int. */
+  return plan->padded/2<=INT_MAX && plan->converted/2<=INT_MAX;
+}
+
+/* Turns the packed spectrum of a sound of from frames into the one of to
+   frames. The values are the same for both sizes, since rfft scales by
+   the size. */
+static void RESAMPLE_rebin(spectrum_t x[],long from,long to){
+  if(to>from){
+    /* The old nyquist value is half of the positive and half of the
+       negative frequency. */
+    x[from]=x[1]/2;
+    x[from+1]=0;
+    memset(x+from+2,0,sizeof(spectrum_t)*(to-from-2));
+    x[1]=0;
+  }else if(to<from){
+    /* Only the real part can be kept at the new nyquist frequency. */
+    x[1]=2*x[to];
+  }
+}
+
+bool RESAMPLE_possible(long N,int R,int newR,long *length){
+  struct ResamplePlan plan;
+
+  if(RESAMPLE_plan(N,R,newR,&plan)==false)
+    return false;
+  *length=plan.length;
+  return true;
+}
+
+long RESAMPLE_worksize(long N,int R,int newR){
+  struct ResamplePlan plan;
+
+  if(RESAMPLE_plan(N,R,newR,&plan)==false)
+    return 0;
+  return mammut_max(plan.padded,plan.converted);
+}
+
+static void RESAMPLE_channel(spectrum_t *x,const struct ResamplePlan *plan,spectrum_t *out){
+  if(plan->padded!=plan->N){
+    rfft(x,plan->N/2,INVERSE);
+    memset(x+plan->N,0,sizeof(spectrum_t)*(plan->padded-plan->N));
+    rfft(x,plan->padded/2,FORWARD);
+  }
+
+  RESAMPLE_rebin(x,plan->padded,plan->converted);
+  rfft(x,plan->converted/2,INVERSE);
+
+  memcpy(out,x,sizeof(spectrum_t)*plan->length);
+}
+
+void RESAMPLE_synthesizeChannel(spectrum_t *x,long N,int R,int newR,spectrum_t *out){
+  struct ResamplePlan plan;
+
+  if(RESAMPLE_plan(N,R,newR,&plan)==true)
+    RESAMPLE_channel(x,&plan,out);
+}
+
+spectrum_t *RESAMPLE_synthesize(const spectrum_t *spectrum,long N,int channels,int R,int newR,long *length){
+  struct ResamplePlan plan;
+  spectrum_t *x,*out;
+  int ch;
+
+  if(RESAMPLE_plan(N,R,newR,&plan)==false)
+    return NULL;
+
+  out=BIGMEM_alloc(plan.length*channels);
+  if(out==NULL)
+    return NULL;
+
+  /* At the same rate, it is only the inverse fft. */
+  if(plan.padded==N && plan.converted==N){
+    memcpy(out,spectrum,sizeof(spectrum_t)*N*channels);
+    rfft_channels(out,N/2,channels,INVERSE);
+    *length=N;
+    return out;
+  }
+
+  x=BIGMEM_alloc(mammut_max(plan.padded,plan.converted));
+  if(x==NULL){
+    BIGMEM_free(out);
+    return NULL;
+  }
+
+  for(ch=0;ch<channels;ch++){
+    GUI_aboveprogressbar(ch,channels);
+    memcpy(x,spectrum+ch*N,sizeof(spectrum_t)*N);
+    RESAMPLE_channel(x,&plan,out+ch*plan.length);
+  }
+
+  BIGMEM_free(x);
+
+  *length=plan.length;
+  return out;
+}
+
+spectrum_t *RESAMPLE_decimate(const spectrum_t *spectrum,long N,int channels,int factor){
+  long length=N/factor;
+  spectrum_t *out;
+  int ch;
+
+  if(factor<1 || (length&1) || length<2)
+    return NULL;
+
+  out=BIGMEM_alloc(length*channels);
+  if(out==NULL)
+    return NULL;
+
+  for(ch=0;ch<channels;ch++){
+    spectrum_t *x=out+ch*length;
+    memcpy(x,spectrum+ch*N,sizeof(spectrum_t)*length);
+    if(length<N)
+      x[1]=2*spectrum[ch*N+length]; /* as in RESAMPLE_rebin */
+  }
+
+  rfft_channels(out,length/2,channels,INVERSE);
+  return out;
+}
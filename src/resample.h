@@ -0,0 +1,37 @@
+
+/* Sample rate conversion done in the frequency domain, by making the
+   sound straight from the spectrum at another rate. The bins below the
+   lowest of the two nyquist frequencies are kept as they are, and the
+   rest are cut off or filled with zeros before the inverse fft, which is
+   exact for everything the spectrum holds.
+
+   The bins only line up when the sound has a whole number of frames at
+   the new rate, so the sound is first padded to such a length when it
+   does not. That needs the ratio between the rates to have no other
+   prime factors than 2, 3, 5 and 7, which all the usual rates have. */
+
+/* Returns true if a sound of N frames at rate R can be converted to newR,
+   and sets *length to the number of frames it has at newR. */
+extern LANGSPEC bool RESAMPLE_possible(long N,int R,int newR,long *length);
+
+/* The inverse fft of the channels of spectrum (N values each, laid out as
+   lyd), at the rate newR. Returns memory from BIGMEM_alloc holding the
+   frames of each channel after each other, length frames each, or NULL if
+   the conversion is not possible or there is no memory. spectrum is not
+   changed. newR can be R, which gives the plain inverse fft. */
+extern LANGSPEC spectrum_t *RESAMPLE_synthesize(const spectrum_t *spectrum,long N,int channels,int R,int newR,long *length);
+
+/* The same, one channel at a time. RESAMPLE_worksize returns how many
+   values of work memory RESAMPLE_synthesizeChannel needs, or 0 if the
+   conversion is not possible. x is the work memory, which holds the N
+   values of the spectrum of the channel when called. The length frames of
+   the channel at newR are put in out. */
+extern LANGSPEC long RESAMPLE_worksize(long N,int R,int newR);
+extern LANGSPEC void RESAMPLE_synthesizeChannel(spectrum_t *x,long N,int R,int newR,spectrum_t *out);
+
+/* The inverse fft of the lowest N/factor bins of each channel, which is
+   the sound at a rate factor times lower, with the frequencies above its
+   nyquist frequency left out. Takes a small part of the time of the whole
+   inverse fft. N/factor must be even. Returns memory from BIGMEM_alloc
+   with N/factor frames of each channel after each other, or NULL. */
+extern LANGSPEC spectrum_t *RESAMPLE_decimate(const spectrum_t *spectrum,long N,int channels,int factor);
@@ -1,5 +1,10 @@
 
 #include "mammut.h"
+#include "bigmem.h"
+#include "resample.h"
+#include "workers.h"
+#include "export.h"
+#include "flacjoin.h"
 
 #include <stdint.h>
 
@@ -16,185 +21,647 @@ bool synthandsave_normalize_gain=false;
 extern struct LoadStruct loadstruct;
 
 
-/* Following function copied from Ceres. */
+float get_normalize_val(const spectrum_t *sound,long length,int channels)
+{
+  long i;
+  int ch;
+  spectrum_t max, samp;
+  const spectrum_t *l;
+  max=-1e+10;
+  for (ch=0; ch<channels; ch++) {
+    l=sound+ch*length;
+    for (i=0; i<length; i++) {
+      samp=*(l+i);
+      if (samp>max) max=samp;
+      if (-samp>max) max=-samp;
+    }
+  }
+  return max=0.9/max;
+}
+
+/* Writing.
+
+   The sound is written in blocks of WRITESOUND_BLOCK frames. The worker
+   threads interleave each block and convert it to the sample format of
+   the file, while a thread of its own writes the blocks before it, so the
+   CPUs and the disk work at the same time. At most WRITESOUND_QUEUE blocks
+   wait to be written.
+
+   16, 24 and 32 bit files get integers, rounded and clipped here, which
+   leaves libsndfile little more to do than to copy them to the file. */
+
+#define WRITESOUND_BLOCK (1<<16)
+#define WRITESOUND_QUEUE 4
+
+enum{
+  WRITESOUND_SPECTRUM,
+  WRITESOUND_SHORT,
+  WRITESOUND_INT24,
+  WRITESOUND_INT32
+};
+
+struct writesound_block{
+  void *data;
+  int frames;
+};
+
+struct writesound_job{
+  SNDFILE *outfile;
+  int type;
+  size_t samplesize;
 
-void SaveWaveConsumer(
-		      void *outfile,
-		      float **samples,
-		      int num_samples
-		      )
+  const spectrum_t *sound;
+  long length;
+  int channels;
+  spectrum_t gain;
+  float *progress;
+
+  /* The block being converted. */
+  void *data;
+  long start;
+  int frames;
+
+  struct writesound_block blocks[WRITESOUND_QUEUE];
+
+  /* Protected by lock. */
+  int first;
+  int num_filled;
+  bool finished;
+
+  struct WORKERS_Lock *lock;
+  struct WORKERS_Event *filled;
+  struct WORKERS_Event *emptied;
+
+  /* Only used by the writing thread until it is finished. */
+  bool failed;
+};
+
+static int writesound_type(int format)
 {
-  int i,ch;
-  
-  static float *framebuff=NULL;
-  static int framebuffsize=0;
-  if( framebuffsize < (num_samples*samps_per_frame)){
-    free(framebuff);
-    framebuffsize=num_samples*samps_per_frame;
-    framebuff = erroralloc (framebuffsize*sizeof(float));
+#ifndef SNDFILE_0
+  switch(format&SF_FORMAT_SUBMASK){
+  case SF_FORMAT_PCM_16: return WRITESOUND_SHORT;
+  case SF_FORMAT_PCM_24: return WRITESOUND_INT24;
+  case SF_FORMAT_PCM_32: return WRITESOUND_INT32;
   }
+#endif
+  return WRITESOUND_SPECTRUM;
+}
+
+/* The same scaling as libsndfile, but clipped. */
+static int writesound_round(double val,double max)
+{
+  if(val>=max)
+    return (int)max;
+  if(val<=-max-1)
+    return (int)(-max-1);
+  return (int)lrint(val);
+}
 
-  for (i=0; i<num_samples; i++) {
-    for (ch=0; ch<samps_per_frame; ch++)
-      *(framebuff+i*samps_per_frame+ch)=(float)(samples[ch][i]);
+#define WRITESOUND_LOOP(type,expr)					\
+  for(ch=0;ch<ws->channels;ch++){					\
+    const spectrum_t *l=ws->sound+ch*ws->length+ws->start;		\
+    type *out=(type*)ws->data+ch;					\
+    for(i=start;i<end;i++)						\
+      out[i*ws->channels]=(expr);					\
   }
-  if(sf_writef_float(outfile,framebuff,num_samples)!=num_samples){
-    printerror("Mammut, error: Could not write to disk completely.\n");
+
+static void writesound_convert_job(void *arg,int worker,int num_workers)
+{
+  struct writesound_job *ws=arg;
+  int start=(int)((long)ws->frames*worker/num_workers);
+  int end=(int)((long)ws->frames*(worker+1)/num_workers);
+  int i,ch;
+
+  switch(ws->type){
+  case WRITESOUND_SPECTRUM:
+    WRITESOUND_LOOP(spectrum_t, l[i]*ws->gain);
+    break;
+  case WRITESOUND_SHORT:
+    WRITESOUND_LOOP(short, writesound_round(l[i]*ws->gain*(double)0x7fff,0x7fff));
+    break;
+  case WRITESOUND_INT24:
+    WRITESOUND_LOOP(int, writesound_round(l[i]*ws->gain*(double)0x7fffff,0x7fffff)*256);
+    break;
+  case WRITESOUND_INT32:
+    WRITESOUND_LOOP(int, writesound_round(l[i]*ws->gain*(double)0x7fffffff,0x7fffffff));
+    break;
   }
 }
 
+#undef WRITESOUND_LOOP
 
+static bool writesound_write(struct writesound_job *ws,const struct writesound_block *block)
+{
+  sf_count_t written;
+
+  switch(ws->type){
+#ifndef SNDFILE_0
+  case WRITESOUND_SHORT:
+    written=sf_writef_short(ws->outfile,block->data,block->frames);
+    break;
+  case WRITESOUND_INT24:
+  case WRITESOUND_INT32:
+    written=sf_writef_int(ws->outfile,block->data,block->frames);
+    break;
+#endif
+  default:
+    written=sf_writef_spectrum(ws->outfile,block->data,block->frames);
+    break;
+  }
+  return written==block->frames;
+}
 
-float get_normalize_val(void)
+static void writesound_thread(void *arg)
 {
-  int i, ch;
-  float max, samp;
-  float *l;
-  max=-1e+10;
-  for (ch=0; ch<samps_per_frame; ch++) {
-    l=lyd+ch*N;
-    for (i=0; i<N; i++) {
-      samp=*(l+i);
-      if (samp>max) max=samp;
-      if (-samp>max) max=-samp;
+  struct writesound_job *ws=arg;
+
+  for(;;){
+    const struct writesound_block *block;
+
+    WORKERS_lock(ws->lock);
+    while(ws->num_filled==0 && ws->finished==false){
+      WORKERS_unlock(ws->lock);
+      WORKERS_waitEvent(ws->filled);
+      WORKERS_lock(ws->lock);
+    }
+    if(ws->num_filled==0){
+      WORKERS_unlock(ws->lock);
+      return;
     }
+    block=&ws->blocks[ws->first];
+    WORKERS_unlock(ws->lock);
+
+    if(ws->failed==false && writesound_write(ws,block)==false)
+      ws->failed=true;
+    if(ws->progress!=NULL)
+      *ws->progress+=(float)block->frames/ws->length;
+
+    WORKERS_lock(ws->lock);
+    ws->first=(ws->first+1)%WRITESOUND_QUEUE;
+    ws->num_filled--;
+    WORKERS_unlock(ws->lock);
+    WORKERS_signalEvent(ws->emptied);
   }
-  return max=0.9/max;
 }
 
-void normalize(){
-  int i, ch;
-  float *l;
-  float max=get_normalize_val();
-  for (ch=0; ch<samps_per_frame; ch++) {
-    l=lyd+ch*N;
-    for (i=0; i<N; i++) *(l+i)*=max;
+bool writesound(const spectrum_t *sound,long length,int channels,bool normalize,SNDFILE *outfile,int format,float *progress)
+{
+  struct writesound_job ws;
+  struct WORKERS_Thread *thread;
+  long start;
+  int i;
+
+  memset(&ws,0,sizeof(ws));
+  ws.outfile=outfile;
+  ws.type=writesound_type(format);
+  ws.samplesize= ws.type==WRITESOUND_SPECTRUM ? sizeof(spectrum_t)
+    : ws.type==WRITESOUND_SHORT ? sizeof(short) : sizeof(int);
+  ws.sound=sound;
+  ws.length=length;
+  ws.channels=channels;
+  ws.gain=normalize ? get_normalize_val(sound,length,channels) : 1;
+  ws.progress=progress;
+  if(progress!=NULL)
+    *progress=0;
+
+  for(i=0;i<WRITESOUND_QUEUE;i++){
+    ws.blocks[i].data=malloc(ws.samplesize*channels*WRITESOUND_BLOCK);
+    if(ws.blocks[i].data==NULL){
+      while(--i>=0)
+	free(ws.blocks[i].data);
+      return false;
+    }
   }
 
-#if 0
-  else if (max>0.99) {
-    fprintf(stderr,"Can\'t save properly. Try to check the \"Normalize gain\" box.\n");
-    return false;
+  ws.lock=WORKERS_newLock();
+  ws.filled=WORKERS_newEvent();
+  ws.emptied=WORKERS_newEvent();
+  thread=WORKERS_startThread(writesound_thread,&ws);
+
+  for(start=0;start<length;start+=WRITESOUND_BLOCK){
+    struct writesound_block *block;
+
+    WORKERS_lock(ws.lock);
+    while(ws.num_filled==WRITESOUND_QUEUE){
+      WORKERS_unlock(ws.lock);
+      WORKERS_waitEvent(ws.emptied);
+      WORKERS_lock(ws.lock);
+    }
+    block=&ws.blocks[(ws.first+ws.num_filled)%WRITESOUND_QUEUE];
+    WORKERS_unlock(ws.lock);
+
+    block->frames=(int)mammut_min(length-start,WRITESOUND_BLOCK);
+    ws.data=block->data;
+    ws.start=start;
+    ws.frames=block->frames;
+    WORKERS_run(writesound_convert_job,&ws,mammut_max(1,mammut_min(WORKERS_getNum(),ws.frames/4096)));
+
+    WORKERS_lock(ws.lock);
+    ws.num_filled++;
+    WORKERS_unlock(ws.lock);
+    WORKERS_signalEvent(ws.filled);
   }
-  return true;
-#endif
 
+  WORKERS_lock(ws.lock);
+  ws.finished=true;
+  WORKERS_unlock(ws.lock);
+  WORKERS_signalEvent(ws.filled);
+  WORKERS_waitThread(thread);
+
+  WORKERS_freeEvent(ws.emptied);
+  WORKERS_freeEvent(ws.filled);
+  WORKERS_freeLock(ws.lock);
+  for(i=0;i<WRITESOUND_QUEUE;i++)
+    free(ws.blocks[i].data);
+
+  return ws.failed==false;
 }
 
 
+#ifndef SNDFILE_0
+
+/* FLAC files.
 
+   The sound is cut in segments of WRITESOUND_SEGMENT frames, and each
+   worker thread encodes a segment of its own to a FLAC stream in memory,
+   through the virtual io of libsndfile. A thread of its own joins the
+   streams into one (see flacjoin.h) and writes them to the file, while
+   the workers encode the next segments. Encoding FLAC takes much more
+   time than converting the samples, so this is what makes FLAC files
+   about as fast to save as WAV files on more than one CPU.
 
-void writesound(
-		void (*WaveConsumer)(
-				void *pointer,
-				float **samples,
-				int num_samples
-				),
-		void *pointer
-		)
+   The segments hold a whole number of FLAC frames for the block sizes
+   libsndfile lets libFLAC use, 1152 and 4096 frames of sound, which is
+   what joining them needs. If the streams can still not be joined, that
+   is found out before the file is opened, and the file is written the
+   ordinary way instead. */
+
+#define WRITESOUND_SEGMENT (36864*16)
+
+struct writesound_memfile{
+  unsigned char *data;
+  sf_count_t size;
+  sf_count_t allocated;
+  sf_count_t pos;
+};
+
+static sf_count_t writesound_memfile_length(void *user)
 {
-  int i, ch;
-  float *l=lyd;
+  struct writesound_memfile *file=user;
+  return file->size;
+}
+
+static sf_count_t writesound_memfile_seek(sf_count_t offset,int whence,void *user)
+{
+  struct writesound_memfile *file=user;
+  sf_count_t pos= whence==SEEK_CUR ? file->pos+offset
+    : whence==SEEK_END ? file->size+offset : offset;
+
+  if(pos<0)
+    return -1;
+  file->pos=pos;
+  return pos;
+}
 
-  static float **ly;
-  static int lysize=0;
-  if(lysize<samps_per_frame){
-    lysize=samps_per_frame;
-    free(ly);
-    ly=erroralloc(sizeof(float*)*lysize);
+static sf_count_t writesound_memfile_read(void *ptr,sf_count_t count,void *user)
+{
+  struct writesound_memfile *file=user;
+
+  count=mammut_max(0,mammut_min(count,file->size-file->pos));
+  memcpy(ptr,file->data+file->pos,count);
+  file->pos+=count;
+  return count;
+}
+
+static sf_count_t writesound_memfile_write(const void *ptr,sf_count_t count,void *user)
+{
+  struct writesound_memfile *file=user;
+
+  if(file->pos+count>file->allocated){
+    sf_count_t allocated=mammut_max(file->pos+count,file->allocated*2);
+    unsigned char *data=realloc(file->data,allocated);
+    if(data==NULL)
+      return 0;
+    file->data=data;
+    file->allocated=allocated;
+  }
+  if(file->pos>file->size)
+    memset(file->data+file->size,0,file->pos-file->size);
+
+  memcpy(file->data+file->pos,ptr,count);
+  file->pos+=count;
+  file->size=mammut_max(file->size,file->pos);
+  return count;
+}
+
+static sf_count_t writesound_memfile_tell(void *user)
+{
+  struct writesound_memfile *file=user;
+  return file->pos;
+}
+
+static SF_VIRTUAL_IO writesound_memfile_io={
+  writesound_memfile_length,
+  writesound_memfile_seek,
+  writesound_memfile_read,
+  writesound_memfile_write,
+  writesound_memfile_tell
+};
+
+struct writesound_flac{
+  struct writesound_job ws; /* How the samples are converted. */
+  SF_INFO sfinfo;
+  long num_segments;
+  int num_workers;
+
+  /* One segment for each worker. The workers encode the segments from
+     first on into encoding, while the ones from firstwritten on in
+     writing are written. */
+  struct writesound_memfile *encoding;
+  struct writesound_memfile *writing;
+  long first;
+  long firstwritten;
+  volatile bool failed;
+
+  /* The header of the first segment, and the one of the file. */
+  unsigned char *header;
+  struct FLACJOIN_Info info;
+  struct FLACJOIN_Info joined;
+
+  /* Only used by the writing thread until it is finished. */
+  FILE *file;
+  unsigned char *out;
+  size_t outsize;
+  bool writefailed;
+};
+
+static void writesound_flac_encode(void *arg,int worker,int num_workers)
+{
+  struct writesound_flac *flac=arg;
+  struct writesound_memfile *file=&flac->encoding[worker];
+  struct writesound_job ws=flac->ws;
+  struct writesound_block block;
+  SF_INFO sfinfo=flac->sfinfo;
+  long segment=flac->first+worker;
+  long end;
+
+  file->size=file->pos=0;
+  if(segment>=flac->num_segments)
+    return;
+
+  block.data=malloc(ws.samplesize*ws.channels*WRITESOUND_BLOCK);
+  ws.outfile= block.data==NULL ? NULL : sf_open_virtual(&writesound_memfile_io,SFM_WRITE,&sfinfo,file);
+  if(ws.outfile==NULL){
+    free(block.data);
+    flac->failed=true;
+    return;
+  }
+
+  ws.data=block.data;
+  end=mammut_min(ws.length,(segment+1)*WRITESOUND_SEGMENT);
+  for(ws.start=segment*WRITESOUND_SEGMENT;ws.start<end && flac->failed==false;ws.start+=WRITESOUND_BLOCK){
+    ws.frames=block.frames=(int)mammut_min(end-ws.start,WRITESOUND_BLOCK);
+    writesound_convert_job(&ws,0,1);
+    if(writesound_write(&ws,&block)==false)
+      flac->failed=true;
   }
 
-  if(synthandsave_normalize_gain)
-    normalize();
+  if(sf_close(ws.outfile)!=0)
+    flac->failed=true;
+  free(block.data);
+}
+
+static void writesound_flac_write(void *arg)
+{
+  struct writesound_flac *flac=arg;
+  int i;
+
+  for(i=0;i<flac->num_workers && flac->firstwritten+i<flac->num_segments;i++){
+    const struct writesound_memfile *file=&flac->writing[i];
+    long segment=flac->firstwritten+i;
+    struct FLACJOIN_Info info;
+    size_t size;
 
-  for(i=0;i<N;i+=1024){
-    for(ch=0;ch<samps_per_frame;ch++){
-      ly[ch]=l+i+(ch*N);
+    if(flac->writefailed==true)
+      return;
+
+    if(FLACJOIN_readHeader(file->data,file->size,&info)==false || info.blocksize!=flac->info.blocksize){
+      flac->writefailed=true;
+      return;
+    }
+
+    size=FLACJOIN_maxSize(file->size,&info);
+    if(size>flac->outsize){
+      unsigned char *out=realloc(flac->out,size);
+      if(out==NULL){
+	flac->writefailed=true;
+	return;
+      }
+      flac->out=out;
+      flac->outsize=size;
     }
-    (*WaveConsumer)(pointer,ly,mammut_min(N-i,1024));
+
+    size=FLACJOIN_frames(file->data,file->size,&info,segment*(WRITESOUND_SEGMENT/info.blocksize),flac->out,&flac->joined);
+    if(size==0 || fwrite(flac->out,1,size,flac->file)!=size)
+      flac->writefailed=true;
+
+    if(flac->ws.progress!=NULL)
+      *flac->ws.progress+=(float)info.samples/flac->ws.length;
   }
+}
 
+static bool writesound_flac_header(struct writesound_flac *flac)
+{
+  size_t size=FLACJOIN_header(flac->header,&flac->info,&flac->joined,flac->out);
+  return fwrite(flac->out,1,size,flac->file)==size;
 }
 
+/* The ordinary way. */
+static bool writesound_file(const spectrum_t *sound,long length,int channels,bool normalize,const char *filename,SF_INFO *sfinfo,float *progress)
+{
+  SNDFILE *outfile=sf_open_write(filename,sfinfo);
+  bool ret;
 
+  if(outfile==NULL)
+    return false;
+  ret=writesound(sound,length,channels,normalize,outfile,sfinfo->format,progress);
+  sf_close(outfile);
 
+  return ret;
+}
 
-static char *das_SaveOk(char *filename)
+bool writesound_flac(const spectrum_t *sound,long length,int channels,bool normalize,const char *filename,int format,int samplerate,float *progress)
 {
+  struct writesound_flac flac;
+  struct writesound_memfile *files;
+  bool ret;
+  int i;
+
+  memset(&flac,0,sizeof(flac));
+  flac.sfinfo.samplerate=samplerate;
+  flac.sfinfo.channels=channels;
+  flac.sfinfo.format=format;
+  flac.num_segments=(length+WRITESOUND_SEGMENT-1)/WRITESOUND_SEGMENT;
+  flac.num_workers=(int)mammut_min(WORKERS_getNum(),flac.num_segments);
+
+  files= flac.num_workers<2 ? NULL : calloc(2*flac.num_workers,sizeof(struct writesound_memfile));
+  if(files==NULL)
+    return writesound_file(sound,length,channels,normalize,filename,&flac.sfinfo,progress);
+
+  flac.ws.type=writesound_type(format);
+  flac.ws.samplesize= flac.ws.type==WRITESOUND_SPECTRUM ? sizeof(spectrum_t)
+    : flac.ws.type==WRITESOUND_SHORT ? sizeof(short) : sizeof(int);
+  flac.ws.sound=sound;
+  flac.ws.length=length;
+  flac.ws.channels=channels;
+  flac.ws.gain=normalize ? get_normalize_val(sound,length,channels) : 1;
+  flac.ws.progress=progress;
+  if(progress!=NULL)
+    *progress=0;
+
+  flac.encoding=files;
+  flac.writing=files+flac.num_workers;
+  flac.joined.samples=length;
+
+  /* The first segments are encoded before the file is opened, to see
+     that they can be joined. */
+  WORKERS_run(writesound_flac_encode,&flac,flac.num_workers);
+  if(flac.failed==false
+     && FLACJOIN_readHeader(files[0].data,files[0].size,&flac.info)==true
+     && WRITESOUND_SEGMENT%flac.info.blocksize==0){
+    flac.header=malloc(flac.info.headersize);
+    flac.out=malloc(flac.info.headersize);
+    flac.outsize=flac.info.headersize;
+    if(flac.header!=NULL && flac.out!=NULL){
+      memcpy(flac.header,files[0].data,flac.info.headersize);
+      flac.file=fopen(filename,"wb");
+    }
+  }
+
+  if(flac.file==NULL){
+    for(i=0;i<2*flac.num_workers;i++)
+      free(files[i].data);
+    free(files);
+    free(flac.header);
+    free(flac.out);
+    return writesound_file(sound,length,channels,normalize,filename,&flac.sfinfo,progress);
+  }
+
+  ret=writesound_flac_header(&flac);
+
+  /* The workers encode the next segments while the thread writes. */
+  while(ret==true){
+    struct writesound_memfile *encoded=flac.encoding;
+    struct WORKERS_Thread *thread;
+
+    flac.encoding=flac.writing;
+    flac.writing=encoded;
+    flac.firstwritten=flac.first;
+    thread=WORKERS_startThread(writesound_flac_write,&flac);
+
+    flac.first+=flac.num_workers;
+    if(flac.first<flac.num_segments)
+      WORKERS_run(writesound_flac_encode,&flac,flac.num_workers);
+
+    WORKERS_waitThread(thread);
+    ret= flac.failed==false && flac.writefailed==false;
+    if(flac.first>=flac.num_segments)
+      break;
+  }
+
+  /* The header again, now that the sizes of the frames are known. */
+  if(ret==true)
+    ret= fseek(flac.file,0,SEEK_SET)==0 && writesound_flac_header(&flac)==true;
+  if(fclose(flac.file)!=0)
+    ret=false;
+
+  for(i=0;i<2*flac.num_workers;i++)
+    free(files[i].data);
+  free(files);
+  free(flac.header);
+  free(flac.out);
+
+  return ret;
+}
+
+#endif
+
 
-  long i,ch;
 
-  /*
-  out_AFsetup=afNewFileSetup();
-  afInitChannels(out_AFsetup, AF_DEFAULT_TRACK, samps_per_frame);
-  afInitRate(out_AFsetup, AF_DEFAULT_TRACK, R);
-  afInitCompression(out_AFsetup, AF_DEFAULT_TRACK, compression);
-  afInitFileFormat(out_AFsetup, filefmt);
-  afInitSampleFormat(out_AFsetup, AF_DEFAULT_TRACK, samp_type, bits_per_samp);
 
-  outfile=afOpenFile(filename, "wb", out_AFsetup);
-  */
+char *SaveOk(char *filename)
+{
+  int samplerate=prefs_save_samplerate>0 ? prefs_save_samplerate : R;
+  long length;
+  SF_INFO sfinfo_write;
+  SNDFILE *outfile;
+  char *error;
 
-  
-  SF_INFO* sfinfo_write=erroralloc(sizeof(SF_INFO));
-  memcpy(sfinfo_write,&loadstruct.sfinfo,sizeof(SF_INFO));
+  memcpy(&sfinfo_write,&loadstruct.sfinfo,sizeof(SF_INFO));
 
   if(strcasecmp(".raw",filename+strlen(filename)-4)==0){
-    sfinfo_write->format = 
-      (sfinfo_write->format & SF_FORMAT_SUBMASK) 
+    sfinfo_write.format = 
+      (sfinfo_write.format & SF_FORMAT_SUBMASK) 
       | (SF_FORMAT_RAW & SF_FORMAT_TYPEMASK);
   }
   if(strcasecmp(".wav",filename+strlen(filename)-4)==0){
-    sfinfo_write->format = 
-      (sfinfo_write->format & SF_FORMAT_SUBMASK) 
+    sfinfo_write.format = 
+      (sfinfo_write.format & SF_FORMAT_SUBMASK) 
       | (SF_FORMAT_WAV & SF_FORMAT_TYPEMASK);
   }
   if(strcasecmp(".aif",filename+strlen(filename)-4)==0){
-    sfinfo_write->format = 
-      (sfinfo_write->format & SF_FORMAT_SUBMASK) 
+    sfinfo_write.format = 
+      (sfinfo_write.format & SF_FORMAT_SUBMASK) 
       | (SF_FORMAT_AIFF & SF_FORMAT_TYPEMASK);
   }
   if(strcasecmp(".aiff",filename+strlen(filename)-5)==0){
-    sfinfo_write->format = 
-      (sfinfo_write->format & SF_FORMAT_SUBMASK) 
+    sfinfo_write.format = 
+      (sfinfo_write.format & SF_FORMAT_SUBMASK) 
       | (SF_FORMAT_AIFF & SF_FORMAT_TYPEMASK);
   }
+#ifndef SNDFILE_0
+  if(strcasecmp(".flac",filename+strlen(filename)-5)==0){
+    int subformat=sfinfo_write.format & SF_FORMAT_SUBMASK;
+    if(subformat!=SF_FORMAT_PCM_S8 && subformat!=SF_FORMAT_PCM_16 && subformat!=SF_FORMAT_PCM_24)
+      subformat= MSF_ISFLOATTYPE(sfinfo_write) || subformat==SF_FORMAT_PCM_32 ? SF_FORMAT_PCM_24 : SF_FORMAT_PCM_16;
+    sfinfo_write.format = subformat | SF_FORMAT_FLAC;
+  }
+  if(strcasecmp(".ogg",filename+strlen(filename)-4)==0){
+    sfinfo_write.format = SF_FORMAT_OGG | SF_FORMAT_VORBIS;
+  }else if((sfinfo_write.format & SF_FORMAT_SUBMASK)==SF_FORMAT_VORBIS){
+    sfinfo_write.format = 
+      (sfinfo_write.format & SF_FORMAT_TYPEMASK)
+      | SF_FORMAT_PCM_16;
+  }
+#endif
 
-  outfile=sf_open_write(filename,sfinfo_write);
+  if (samplerate!=R && RESAMPLE_possible(N,R,samplerate,&length)==false)
+    return "Can not convert the sound to the \"Save Sample Rate\"";
+  sfinfo_write.samplerate=samplerate;
 
+  /* The file is opened here, so that errors opening it are shown at once.
+     The rest is done by a thread of its own, on the spectrum as it is
+     now, while editing goes on. */
+  outfile=sf_open_write(filename,&sfinfo_write);
   if (outfile==NULL) {
     fprintf(stderr,"Can\'t open file.\n");
     return "Can\'t open file";
   }
-  for (i=0; i<samps_per_frame*N; i++) lyd2[i]=lyd[i];
-
-  for (ch=0; ch<samps_per_frame; ch++) {
-    GUI_aboveprogressbar(ch,samps_per_frame);
-    rfft(lyd+ch*N,  N/2,  INVERSE);
+#ifndef SNDFILE_0
+  /* FLAC files are opened again by writesound_flac. */
+  if((sfinfo_write.format & SF_FORMAT_TYPEMASK)==SF_FORMAT_FLAC){
+    sf_close(outfile);
+    outfile=NULL;
   }
+#endif
 
-  writesound(SaveWaveConsumer,outfile);
-  
-  //  afCloseFile(outfile);
-  sf_close(outfile);
+  error=EXPORT_start(filename,outfile,sfinfo_write.format,samplerate,synthandsave_normalize_gain);
+  if (error!=NULL)
+    return error;
 
-  for (i=0; i<samps_per_frame*N; i++) lyd[i]=lyd2[i];
   strcpy(playfile, filename);
-
-  free(sfinfo_write);
+  GUI_showexports();
 
   return NULL;
 }
-
-static char *das_filename;
-static char *das_ret;
-static void das_das_SaveOk(void){
-  das_ret=das_SaveOk(das_filename);
-}
-
-char *SaveOk(char *filename){
-  das_filename=filename;
-  GUI_newprocess(das_das_SaveOk);
-  return das_ret;
-}
-
@@ -0,0 +1,472 @@
+#include "mammut.h"
+#include "workers.h"
+#include "speccache.h"
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#  include <sys/utime.h>
+#  define SPECCACHE_SEP "\\"
+#else
+#  include <utime.h>
+#  define SPECCACHE_SEP "/"
+#endif
+
+
+#define SPECCACHE_MAGIC "mammut spectrum"
+#define SPECCACHE_HEADERSIZE 4096
+
+/* Values read or written at a time. */
+#define SPECCACHE_BLOCK (1<<18)
+
+/* Number of files SPECCACHE_makeKey remembers the hash of. */
+#define SPECCACHE_MEMOS 8
+
+/* Temporary files (see SPECCACHE_store) that have not been written to for
+   this many seconds are left over from a crash. Writing an entry takes
+   much less, also for another mammut using the same cache. */
+#define SPECCACHE_STALE (60*60)
+
+
+struct SpecCacheHeader{
+  char magic[16];
+  struct SpecCacheKey key;
+};
+
+struct SpecCacheEntry{
+  char *name;
+  unsigned long long size;
+  time_t mtime;
+};
+
+struct SpecCacheMemo{
+  char *filename;
+  unsigned long long size;
+  time_t mtime;
+  unsigned long long hash;
+};
+
+static struct SpecCacheMemo memos[SPECCACHE_MEMOS];
+static int nextmemo=0;
+
+/* For memos and nextmemo, since the cache is also used by the background
+   analysis. (see preanalyze.c) */
+static struct WORKERS_Lock *memolock;
+
+
+
+/* Files */
+
+static bool SPECCACHE_stat(const char *name,unsigned long long *size,time_t *mtime){
+#ifdef _WIN32
+  struct _stati64 st;
+  if(_stati64(name,&st)!=0)
+    return false;
+#else
+  struct stat st;
+  if(stat(name,&st)!=0)
+    return false;
+#endif
+  *size=(unsigned long long)st.st_size;
+  *mtime=st.st_mtime;
+  return true;
+}
+
+static void SPECCACHE_mkdir(const char *name){
+#ifdef _WIN32
+  mkdir(name);
+#else
+  mkdir(name,0755);
+#endif
+}
+
+/* Makes the directory too, if it is not there. */
+static bool SPECCACHE_dir(char *dir,int size){
+  const char *base;
+
+#if defined(_WIN32)
+  base=getenv("LOCALAPPDATA");
+  if(base==NULL)
+    base=getenv("APPDATA");
+  if(base==NULL)
+    return false;
+  snprintf(dir,size,"%s\\mammut",base);
+  SPECCACHE_mkdir(dir);
+  snprintf(dir,size,"%s\\mammut\\speccache",base);
+#elif defined(__APPLE__)
+  base=getenv("HOME");
+  if(base==NULL)
+    return false;
+  snprintf(dir,size,"%s/Library/Caches/mammut",base);
+#else
+  base=getenv("XDG_CACHE_HOME");
+  if(base!=NULL && base[0]!=0)
+    snprintf(dir,size,"%s/mammut",base);
+  else{
+    base=getenv("HOME");
+    if(base==NULL)
+      return false;
+    snprintf(dir,size,"%s/.cache",base);
+    SPECCACHE_mkdir(dir);
+    snprintf(dir,size,"%s/.cache/mammut",base);
+  }
+#endif
+  SPECCACHE_mkdir(dir);
+  return true;
+}
+
+static bool SPECCACHE_entryName(const struct SpecCacheKey *key,char *name,int size){
+  char dir[1024];
+
+  if(SPECCACHE_dir(dir,sizeof(dir))==false)
+    return false;
+  snprintf(name,size,"%s" SPECCACHE_SEP "%016llx-%ld-%d-%d-%d-%d.spec",
+	   dir,key->hash,key->N,key->channels,key->samplerate,key->dobler,key->precision);
+  return true;
+}
+
+static bool SPECCACHE_sameKey(const struct SpecCacheKey *k1,const struct SpecCacheKey *k2){
+  return k1->hash==k2->hash && k1->N==k2->N && k1->frames==k2->frames && k1->channels==k2->channels
+    && k1->samplerate==k2->samplerate && k1->dobler==k2->dobler && k1->precision==k2->precision;
+}
+
+static unsigned long long SPECCACHE_entrySize(const struct SpecCacheKey *key){
+  return SPECCACHE_HEADERSIZE + (unsigned long long)key->N*key->channels*sizeof(spectrum_t);
+}
+
+
+
+/* Hash. A 64 bit hash made from four independent lanes, fast enough to
+   not slow down reading the file. (the same mixing as xxHash64) */
+
+#define SPECCACHE_PRIME1 0x9E3779B185EBCA87ULL
+#define SPECCACHE_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define SPECCACHE_PRIME3 0x165667B19E3779F9ULL
+
+static uint64_t SPECCACHE_round(uint64_t acc,uint64_t input){
+  acc+=input*SPECCACHE_PRIME2;
+  acc=(acc<<31)|(acc>>33);
+  return acc*SPECCACHE_PRIME1;
+}
+
+static bool SPECCACHE_hashFile(const char *filename,unsigned long long *hash){
+  const size_t blocksize=1<<20;
+  unsigned char *block;
+  uint64_t lane[4]={SPECCACHE_PRIME1,SPECCACHE_PRIME2,SPECCACHE_PRIME3,0};
+  uint64_t h,total=0;
+  FILE *file;
+  size_t num,i;
+
+  file=fopen(filename,"rb");
+  if(file==NULL)
+    return false;
+
+  block=malloc(blocksize);
+  if(block==NULL){
+    fclose(file);
+    return false;
+  }
+
+  /* Full blocks are always a multiple of 32 bytes, so only the last one
+     can have a tail. */
+  do{
+    num=fread(block,1,blocksize,file);
+    total+=num;
+    for(i=0;i+32<=num;i+=32){
+      uint64_t v[4];
+      memcpy(v,block+i,32);
+      lane[0]=SPECCACHE_round(lane[0],v[0]);
+      lane[1]=SPECCACHE_round(lane[1],v[1]);
+      lane[2]=SPECCACHE_round(lane[2],v[2]);
+      lane[3]=SPECCACHE_round(lane[3],v[3]);
+    }
+    for(;i<num;i++)
+      lane[i&3]=SPECCACHE_round(lane[i&3],block[i]);
+  }while(num==blocksize);
+
+  free(block);
+  if(ferror(file)){
+    fclose(file);
+    return false;
+  }
+  fclose(file);
+
+  h=total*SPECCACHE_PRIME3;
+  for(i=0;i<4;i++){
+    h^=SPECCACHE_round(0,lane[i]);
+    h=h*SPECCACHE_PRIME1+SPECCACHE_PRIME3;
+  }
+  h^=h>>33;
+  h*=SPECCACHE_PRIME2;
+  h^=h>>29;
+
+  *hash=h;
+  return true;
+}
+
+static bool SPECCACHE_hash(const char *filename,unsigned long long *hash){
+  unsigned long long size;
+  time_t mtime;
+  int i;
+
+  if(SPECCACHE_stat(filename,&size,&mtime)==false)
+    return false;
+
+  WORKERS_lock(memolock);
+  for(i=0;i<SPECCACHE_MEMOS;i++){
+    struct SpecCacheMemo *memo=&memos[i];
+    if(memo->filename!=NULL && !strcmp(memo->filename,filename) && memo->size==size && memo->mtime==mtime){
+      *hash=memo->hash;
+      WORKERS_unlock(memolock);
+      return true;
+    }
+  }
+  WORKERS_unlock(memolock);
+
+  GUI_progressmessage("Checking the spectrum cache");
+  if(SPECCACHE_hashFile(filename,hash)==false)
+    return false;
+
+  WORKERS_lock(memolock);
+  free(memos[nextmemo].filename);
+  memos[nextmemo].filename=strdup(filename);
+  memos[nextmemo].size=size;
+  memos[nextmemo].mtime=mtime;
+  memos[nextmemo].hash=*hash;
+  nextmemo=(nextmemo+1)%SPECCACHE_MEMOS;
+  WORKERS_unlock(memolock);
+
+  return true;
+}
+
+
+
+/* Keeping the size down */
+
+static int SPECCACHE_compareEntries(const void *a,const void *b){
+  const struct SpecCacheEntry *e1=a;
+  const struct SpecCacheEntry *e2=b;
+  return e1->mtime<e2->mtime ? -1 : e1->mtime>e2->mtime ? 1 : 0;
+}
+
+/* Deletes the least recently used entries until there is room for size
+   more bytes. */
+static void SPECCACHE_makeRoom(unsigned long long size){
+  unsigned long long budget=(unsigned long long)prefs_speccache_mb<<20;
+  unsigned long long total=size;
+  struct SpecCacheEntry *entries=NULL;
+  int num_entries=0,i;
+  char dir[1024];
+  struct dirent *dirent;
+  DIR *d;
+
+  if(SPECCACHE_dir(dir,sizeof(dir))==false)
+    return;
+  d=opendir(dir);
+  if(d==NULL)
+    return;
+
+  while((dirent=readdir(d))!=NULL){
+    int len=strlen(dirent->d_name);
+    char name[1200];
+    struct SpecCacheEntry *new_entries;
+
+    if(len<5 || strcmp(dirent->d_name+len-5,".spec"))
+      continue;
+
+    new_entries=realloc(entries,sizeof(struct SpecCacheEntry)*(num_entries+1));
+    if(new_entries==NULL)
+      break;
+    entries=new_entries;
+
+    snprintf(name,sizeof(name),"%s" SPECCACHE_SEP "%s",dir,dirent->d_name);
+    if(SPECCACHE_stat(name,&entries[num_entries].size,&entries[num_entries].mtime)==false)
+      continue;
+    entries[num_entries].name=strdup(name);
+    total+=entries[num_entries].size;
+    num_entries++;
+  }
+  closedir(d);
+
+  qsort(entries,num_entries,sizeof(struct SpecCacheEntry),SPECCACHE_compareEntries);
+
+  for(i=0;i<num_entries;i++){
+    if(total>budget && entries[i].name!=NULL && remove(entries[i].name)==0)
+      total-=entries[i].size;
+    free(entries[i].name);
+  }
+  free(entries);
+}
+
+/* SPECCACHE_makeRoom does not see the temporary files, so those left over
+   from a crash are deleted here. */
+static void SPECCACHE_removeStale(void){
+  time_t now=time(NULL);
+  char dir[1024];
+  struct dirent *dirent;
+  DIR *d;
+
+  if(SPECCACHE_dir(dir,sizeof(dir))==false)
+    return;
+  d=opendir(dir);
+  if(d==NULL)
+    return;
+
+  while((dirent=readdir(d))!=NULL){
+    int len=strlen(dirent->d_name);
+    char name[1200];
+    unsigned long long size;
+    time_t mtime;
+
+    if(len<4 || strcmp(dirent->d_name+len-4,".tmp"))
+      continue;
+
+    snprintf(name,sizeof(name),"%s" SPECCACHE_SEP "%s",dir,dirent->d_name);
+    if(SPECCACHE_stat(name,&size,&mtime)==true && now-mtime>SPECCACHE_STALE)
+      remove(name);
+  }
+  closedir(d);
+}
+
+
+
+/* The interface */
+
+void SPECCACHE_init(void){
+  memolock=WORKERS_newLock();
+  SPECCACHE_removeStale();
+}
+
+bool SPECCACHE_makeKey(struct SpecCacheKey *key,const char *filename,const SF_INFO *sfinfo,long N,int dobler){
+  if(prefs_speccache_mb<=0)
+    return false;
+
+  memset(key,0,sizeof(struct SpecCacheKey));
+  if(SPECCACHE_hash(filename,&key->hash)==false)
+    return false;
+
+  key->N=N;
+  key->frames=(long)sfinfo->MSF_FRAMENAME;
+  key->channels=sfinfo->channels;
+  key->samplerate=sfinfo->samplerate;
+  key->dobler=dobler;
+  key->precision=sizeof(spectrum_t);
+
+  return true;
+}
+
+bool SPECCACHE_has(const struct SpecCacheKey *key){
+  char name[1200];
+  unsigned long long size;
+  time_t mtime;
+
+  return SPECCACHE_entryName(key,name,sizeof(name))==true
+    && SPECCACHE_stat(name,&size,&mtime)==true
+    && size==SPECCACHE_entrySize(key);
+}
+
+bool SPECCACHE_load(const struct SpecCacheKey *key,spectrum_t *ly){
+  struct SpecCacheHeader header;
+  char name[1200];
+  unsigned long long size;
+  time_t mtime;
+  size_t num=(size_t)key->N*key->channels;
+  size_t pos;
+  FILE *file;
+
+  if(SPECCACHE_entryName(key,name,sizeof(name))==false)
+    return false;
+  if(SPECCACHE_stat(name,&size,&mtime)==false || size!=SPECCACHE_entrySize(key))
+    return false;
+
+  file=fopen(name,"rb");
+  if(file==NULL)
+    return false;
+
+  if(fread(&header,sizeof(header),1,file)!=1
+     || memcmp(header.magic,SPECCACHE_MAGIC,sizeof(header.magic))
+     || SPECCACHE_sameKey(&header.key,key)==false
+     || fseek(file,SPECCACHE_HEADERSIZE,SEEK_SET)!=0)
+  {
+    fclose(file);
+    return false;
+  }
+
+  GUI_progressmessage("Reading the spectrum from the cache");
+
+  for(pos=0;pos<num;pos+=SPECCACHE_BLOCK){
+    size_t n=mammut_min((size_t)SPECCACHE_BLOCK,num-pos);
+    if(fread(ly+pos,sizeof(spectrum_t),n,file)!=n){
+      /* The caller expects zeroed memory for the zero padding. */
+      memset(ly,0,sizeof(spectrum_t)*num);
+      fclose(file);
+      return false;
+    }
+  }
+  fclose(file);
+
+  /* Most recently used. */
+  utime(name,NULL);
+
+  return true;
+}
+
+void SPECCACHE_store(const struct SpecCacheKey *key,const spectrum_t *ly){
+  static char zeros[SPECCACHE_HEADERSIZE];
+  struct SpecCacheHeader header;
+  char name[1200],tempname[1240];
+  unsigned long long size=SPECCACHE_entrySize(key);
+  size_t num=(size_t)key->N*key->channels;
+  size_t pos;
+  bool ok=true;
+  FILE *file;
+
+  if(size > (unsigned long long)prefs_speccache_mb<<20)
+    return;
+  if(SPECCACHE_entryName(key,name,sizeof(name))==false)
+    return;
+
+  SPECCACHE_makeRoom(size);
+
+  memset(&header,0,sizeof(header));
+  strcpy(header.magic,SPECCACHE_MAGIC);
+  header.key=*key;
+
+  /* Written to a temporary name first, so that an entry is never seen
+     half written. The name is made from ly, so that two threads storing
+     the same entry do not write to the same file. */
+  snprintf(tempname,sizeof(tempname),"%s.%p.tmp",name,(const void*)ly);
+  file=fopen(tempname,"wb");
+  if(file==NULL)
+    return;
+
+  GUI_progressmessage("Writing the spectrum to the cache");
+
+  if(fwrite(&header,sizeof(header),1,file)!=1
+     || fwrite(zeros,SPECCACHE_HEADERSIZE-sizeof(header),1,file)!=1)
+    ok=false;
+
+  for(pos=0;ok && pos<num;pos+=SPECCACHE_BLOCK){
+    size_t n=mammut_min((size_t)SPECCACHE_BLOCK,num-pos);
+    if(fwrite(ly+pos,sizeof(spectrum_t),n,file)!=n)
+      ok=false;
+  }
+
+  if(fclose(file)!=0)
+    ok=false;
+
+  if(ok==false){
+    fprintf(stderr,"Could not write %s\n",tempname);
+    remove(tempname);
+    return;
+  }
+
+  remove(name);
+  if(rename(tempname,name)!=0)
+    remove(tempname);
+}
@@ -0,0 +1,46 @@
+
+/* A cache of analyzed spectra on disk, so that loading a sound that has
+   been analyzed before only has to read the spectrum back.
+
+   The entries are found by a hash of the contents of the sound file
+   (not the name), the fft size, the number of channels, the sample rate,
+   the duration doubling and the precision of spectrum_t. Each entry is
+   a file with a 4096 byte header followed by the spectrum exactly as it
+   is in lyd, so it can also be mapped into memory.
+
+   The cache is kept below prefs_speccache_mb megabytes by deleting the
+   least recently used entries. 0 turns the cache off. */
+
+struct SpecCacheKey{
+  unsigned long long hash;
+  long N;
+  long frames;
+  int channels;
+  int samplerate;
+  int dobler;
+  int precision; /* sizeof(spectrum_t) */
+};
+
+/* The dobler of spectra padded to a size that is not the size of the
+   sound with the duration doubled, like the partner sounds of Load &
+   Multiply. (see loadmult.c) */
+#define SPECCACHE_PADDED -1
+
+/* Also deletes the temporary files of entries that were never finished,
+   because mammut crashed while writing them. */
+extern LANGSPEC void SPECCACHE_init(void);
+
+/* Hashes the file. Returns false if the cache is off or the file can not
+   be read. The hash of the last few files is remembered, as long as
+   their size and modification time stay the same. */
+extern LANGSPEC bool SPECCACHE_makeKey(struct SpecCacheKey *key,const char *filename,const SF_INFO *sfinfo,long N,int dobler);
+
+/* True if the spectrum is in the cache. */
+extern LANGSPEC bool SPECCACHE_has(const struct SpecCacheKey *key);
+
+/* Puts the cached spectrum into ly (N*channels values) and returns true,
+   or returns false if it is not in the cache. ly is left zeroed then. */
+extern LANGSPEC bool SPECCACHE_load(const struct SpecCacheKey *key,spectrum_t *ly);
+
+/* Adds the spectrum to the cache, deleting old entries to make room. */
+extern LANGSPEC void SPECCACHE_store(const struct SpecCacheKey *key,const spectrum_t *ly);
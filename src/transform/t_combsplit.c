@@ -1,5 +1,7 @@
 
 #include "mammut.h"
+#include "../bigmem.h"
+#include "../workers.h"
 #include <stdlib.h>
 
 int combsplit_block_size_default=99;
@@ -10,57 +12,79 @@ int combsplit_number_of_files=10;
 
 extern struct LoadStruct loadstruct;
 
-void combsplit_ok(void)
-{
-  int i,ch;
-  int div,num;
-  char filename[200]={0},tmpfn[200]={0};
-  char extension[20]={0};
-  char *extp;
 
-  int nch,nchN;
+/* The files are made a batch of bands at a time, as many as fit in
+   memory. The bands are masked out of lyd by the worker threads, and
+   made into sound by one rfft_channels for all the channels of all of
+   them, which spreads them over the CPUs when each one is too small to be
+   split. A thread of its own writes the files of a batch while the next
+   one is made, if there is room for two batches. Otherwise lyd2 is used
+   for one band at a time. */
 
-  GUI_aboveprogressbar(0,samps_per_frame*num);
-    
-  div=combsplit_block_size;
-  num=combsplit_number_of_files;
-  
-  for (i=0; i<samps_per_frame*N; i++) lyd2[i]=lyd[i];  
+struct combsplit_batch{
+  spectrum_t *bands; /* num bands of samps_per_frame channels of N values */
+  int first;
+  int num;
+};
+
+struct combsplit_mask_job{
+  const struct combsplit_batch *batch;
+  int div;
+  int num;
+};
+
+static void combsplit_mask_job(void *arg,int worker,int num_workers)
+{
+  struct combsplit_mask_job *job=arg;
+  const struct combsplit_batch *batch=job->batch;
+  long start=(N/2)*worker/num_workers;
+  long end=(N/2)*(worker+1)/num_workers;
+  long i;
+  int band,nch;
 
   /* rett kanal : (i/div)%num==kanalnr */
-  for (ch=0; ch<num; ch++) {
-    printf("ch: %d\n",ch);
+  for(band=0;band<batch->num;band++){
     for(nch=0;nch<samps_per_frame;nch++){
-      nchN=nch*N;
-      for (i=0; i<N/2; i++) {
-	if ( ((i/div)%num)==ch) {
-	  lyd[i+i+nchN]=lyd2[i+i+nchN]; lyd[i+i+1+nchN]=lyd2[i+i+1+nchN];
-	} else { 
-	  lyd[i+i+nchN]=0.; lyd[i+i+1+nchN]=0.;
-	}  
+      const spectrum_t *in=lyd+nch*N;
+      spectrum_t *out=batch->bands+((size_t)band*samps_per_frame+nch)*N;
+      for(i=start;i<end;){
+	long blockend=mammut_min(end,(i/job->div+1)*job->div);
+	if((i/job->div)%job->num==batch->first+band)
+	  memcpy(out+i+i,in+i+i,sizeof(spectrum_t)*2*(blockend-i));
+	else
+	  memset(out+i+i,0,sizeof(spectrum_t)*2*(blockend-i));
+	i=blockend;
       }
     }
+  }
+}
 
-    /*og s m vi lagre da*/
-    extp=strrchr(playfile,'.');
-    if(extp>strrchr(playfile,'/')) { 
-      strcpy(extension,++extp);
-      strncpy(tmpfn,playfile,(extp-playfile)-1);
-      //      tmpfn[extp-playfile-1]=0;
-      sprintf(filename,"%s-%d.%s",tmpfn,ch,extension);
-    }else{ 
-      sprintf(filename,"%s-%d",playfile,ch);
-    }
+static void combsplit_filename(int ch,char *filename)
+{
+  char tmpfn[200]={0};
+  char extension[20]={0};
+  char *extp;
+
+  extp=strrchr(playfile,'.');
+  if(extp>strrchr(playfile,'/')) { 
+    strcpy(extension,++extp);
+    strncpy(tmpfn,playfile,(extp-playfile)-1);
+    sprintf(filename,"%s-%d.%s",tmpfn,ch,extension);
+  }else{ 
+    sprintf(filename,"%s-%d",playfile,ch);
+  }
+}
+
+static void combsplit_write(void *arg)
+{
+  const struct combsplit_batch *batch=arg;
+  char filename[200]={0};
+  SNDFILE *outfile;
+  int band;
 
-    /*
-    out_AFsetup=afNewFileSetup();
-    afInitChannels(out_AFsetup, AF_DEFAULT_TRACK, samps_per_frame);
-    afInitRate(out_AFsetup, AF_DEFAULT_TRACK, R);
-    afInitCompression(out_AFsetup, AF_DEFAULT_TRACK, compression);
-    afInitFileFormat(out_AFsetup, filefmt);
-    afInitSampleFormat(out_AFsetup, AF_DEFAULT_TRACK, samp_type, bits_per_samp);
-    outfile=afOpenFile(filename, "wb", out_AFsetup);
-    */
+  for(band=0;band<batch->num;band++){
+    /*og s m vi lagre da*/
+    combsplit_filename(batch->first+band,filename);
 
     outfile=sf_open_write(filename,&loadstruct.sfinfo);
 
@@ -69,17 +93,72 @@ void combsplit_ok(void)
       continue;
     }
 
-    for(nch=0;nch<samps_per_frame;nch++){
-      GUI_aboveprogressbar(ch*samps_per_frame + nch,samps_per_frame*num);
-      nchN=nch*N;
-      rfft(lyd+nchN,N/2,INVERSE);
+    if(writesound(batch->bands+(size_t)band*samps_per_frame*N,N,samps_per_frame,synthandsave_normalize_gain,outfile,loadstruct.sfinfo.format,NULL)==false)
+      fprintf(stderr,"Could not write \"%s\" completely.\n",filename);
+    sf_close(outfile);
+  }
+}
+
+void combsplit_ok(void)
+{
+  struct combsplit_batch batches[2];
+  struct combsplit_mask_job job;
+  struct WORKERS_Thread *thread=NULL;
+  size_t bandsize=(size_t)samps_per_frame*N;
+  int num_batches=2;
+  int div,num;
+  int perbatch,first,b;
+
+  div=combsplit_block_size;
+  num=combsplit_number_of_files;
+
+  for(perbatch=num;perbatch>1 && BIGMEM_hasRoom(2*perbatch*bandsize)==false;perbatch--);
+
+  batches[0].bands=NULL;
+  batches[1].bands=NULL;
+  if(BIGMEM_hasRoom(2*perbatch*bandsize)==true){
+    batches[0].bands=BIGMEM_alloc(perbatch*bandsize);
+    batches[1].bands=BIGMEM_alloc(perbatch*bandsize);
+  }
+  if(batches[0].bands==NULL || batches[1].bands==NULL){
+    BIGMEM_free(batches[0].bands);
+    BIGMEM_free(batches[1].bands);
+    batches[0].bands=lyd2;
+    perbatch=1;
+    num_batches=1;
+  }
+
+  job.div=div;
+  job.num=num;
+
+  for(first=0,b=0;first<num;first+=perbatch,b=(b+1)%num_batches){
+    struct combsplit_batch *batch=&batches[b];
+
+    GUI_aboveprogressbar(first,num);
+
+    /* With only one batch, it must be written before the next is made. */
+    if(num_batches==1 && thread!=NULL){
+      WORKERS_waitThread(thread);
+      thread=NULL;
     }
 
-    writesound(SaveWaveConsumer,outfile);
-    //    afCloseFile(outfile);
-    sf_close(outfile);
+    batch->first=first;
+    batch->num=mammut_min(perbatch,num-first);
+    job.batch=batch;
+    WORKERS_run(combsplit_mask_job,&job,mammut_max(1,mammut_min(WORKERS_getNum(),N/2/4096)));
+
+    rfft_channels(batch->bands,N/2,batch->num*samps_per_frame,INVERSE);
+
+    if(thread!=NULL)
+      WORKERS_waitThread(thread);
+    thread=WORKERS_startThread(combsplit_write,batch);
   }
-  
-  for (i=0; i<samps_per_frame*N; i++) lyd[i]=lyd2[i];
 
+  if(thread!=NULL)
+    WORKERS_waitThread(thread);
+
+  if(num_batches==2){
+    BIGMEM_free(batches[0].bands);
+    BIGMEM_free(batches[1].bands);
+  }
 }
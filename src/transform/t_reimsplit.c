@@ -61,7 +61,8 @@ void split_real_imag_ok(void)
       rfft(lyd+nchN,N/2,INVERSE);
     }
 
-    writesound(SaveWaveConsumer,outfile);
+    if(writesound(lyd,N,samps_per_frame,synthandsave_normalize_gain,outfile,loadstruct.sfinfo.format,NULL)==false)
+      fprintf(stderr,"Could not write \"%s\" completely.\n",filename);
 
     sf_close(outfile);
   }
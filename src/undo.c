@@ -109,7 +109,7 @@ char *UNDO_addLyd(void){
     return NULL;
   }
 
-  if(TF_write(undo_lyd->lydfile,lyd,N,samps_per_frame*sizeof(float))==false){
+  if(TF_write(undo_lyd->lydfile,lyd,N,samps_per_frame*sizeof(spectrum_t))==false){
     printerror("Could not make undo.\n");
     TF_delete(undo_lyd->lydfile);
     free(undo_lyd);
@@ -168,7 +168,7 @@ static void UNDO_doInternal(void){
   if(temp==NULL)
     return;
 
-  if(TF_write(temp,lyd,N,samps_per_frame*sizeof(float))==false){
+  if(TF_write(temp,lyd,N,samps_per_frame*sizeof(spectrum_t))==false){
     printerror("Problem making redo\n");
   }
 
@@ -176,8 +176,9 @@ static void UNDO_doInternal(void){
   //fseek(ut->lydfile->file,0,SEEK_SET);
 
   MC_stop();
+  MC_spectrumChanging();
 
-  TF_read(ut->lydfile,lyd,N,sizeof(float)*samps_per_frame);
+  TF_read(ut->lydfile,lyd,N,sizeof(spectrum_t)*samps_per_frame);
 
   TF_delete(ut->lydfile);
   ut->lydfile=temp;
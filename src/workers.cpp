@@ -0,0 +1,202 @@
+
+#include "mammut.h"
+#include "juce.h"
+#include "workers.h"
+
+
+#define MAX_WORKERS 64
+
+
+class Worker : public Thread
+{
+public:
+  Worker() : Thread(T("mammut worker")) {
+    func=NULL;
+  }
+
+  void run()
+  {
+    while(true){
+      startevent.wait();
+      if(threadShouldExit())
+	return;
+      func(arg,worker,num_workers);
+      doneevent.signal();
+    }
+  }
+
+  void (*func)(void *arg,int worker,int num_workers);
+  void *arg;
+  int worker;
+  int num_workers;
+
+  WaitableEvent startevent;
+  WaitableEvent doneevent;
+};
+
+
+static Worker *workers[MAX_WORKERS]={NULL};
+static CriticalSection workerslock;
+
+/* True while a background thread has the pool. (see WORKERS_run) */
+static volatile bool workers_background=false;
+
+
+int WORKERS_getNum(void){
+  int num=prefs_fftthreads>0 ? prefs_fftthreads : SystemStats::getNumCpus();
+  if(num<1)
+    num=1;
+  if(num>MAX_WORKERS)
+    num=MAX_WORKERS;
+  return num;
+}
+
+
+void WORKERS_run(void (*func)(void *arg,int worker,int num_workers),void *arg,int num_workers){
+  bool background=WORKERS_isBackground();
+  bool pool=false;
+  int i;
+
+  if(num_workers>MAX_WORKERS)
+    num_workers=MAX_WORKERS;
+
+  /* A background thread only gets the pool when it is idle, and only for
+     this call, so waiting for it is quicker than doing everything in the
+     calling thread. A worker of the pool would wait for itself. */
+  if(num_workers>1){
+    if(workerslock.tryEnter()==true)
+      pool=true;
+    else if(background==false && workers_background==true
+	    && dynamic_cast<Worker*>(Thread::getCurrentThread())==NULL){
+      workerslock.enter();
+      pool=true;
+    }
+  }
+
+  if(pool==false){
+    for(i=0;i<num_workers;i++)
+      func(arg,i,num_workers);
+    return;
+  }
+
+  workers_background=background;
+
+  for(i=1;i<num_workers;i++){
+    if(workers[i]==NULL){
+      workers[i]=new Worker();
+      workers[i]->startThread();
+    }
+    workers[i]->func=func;
+    workers[i]->arg=arg;
+    workers[i]->worker=i;
+    workers[i]->num_workers=num_workers;
+    workers[i]->startevent.signal();
+  }
+
+  func(arg,0,num_workers);
+
+  for(i=1;i<num_workers;i++)
+    workers[i]->doneevent.wait();
+
+  workers_background=false;
+  workerslock.exit();
+}
+
+
+
+struct WORKERS_Thread : public Thread
+{
+  WORKERS_Thread(void (*das_func)(void *arg),void *das_arg,bool das_background,bool das_quiet) : Thread(T("mammut thread")) {
+    func=das_func;
+    arg=das_arg;
+    background=das_background;
+    quiet=das_quiet;
+  }
+
+  void run()
+  {
+    func(arg);
+  }
+
+  void (*func)(void *arg);
+  void *arg;
+  bool background;
+  bool quiet;
+};
+
+struct WORKERS_Thread *WORKERS_startThread(void (*func)(void *arg),void *arg){
+  struct WORKERS_Thread *thread=new WORKERS_Thread(func,arg,false,false);
+  thread->startThread();
+  return thread;
+}
+
+struct WORKERS_Thread *WORKERS_startBackgroundThread(void (*func)(void *arg),void *arg){
+  struct WORKERS_Thread *thread=new WORKERS_Thread(func,arg,true,true);
+  thread->startThread(0);
+  return thread;
+}
+
+struct WORKERS_Thread *WORKERS_startJobThread(void (*func)(void *arg),void *arg){
+  struct WORKERS_Thread *thread=new WORKERS_Thread(func,arg,false,true);
+  thread->startThread();
+  return thread;
+}
+
+bool WORKERS_isBackground(void){
+  WORKERS_Thread *thread=dynamic_cast<WORKERS_Thread*>(Thread::getCurrentThread());
+  return thread!=NULL && thread->background;
+}
+
+bool WORKERS_isQuiet(void){
+  WORKERS_Thread *thread=dynamic_cast<WORKERS_Thread*>(Thread::getCurrentThread());
+  return thread!=NULL && thread->quiet;
+}
+
+void WORKERS_waitThread(struct WORKERS_Thread *thread){
+  thread->waitForThreadToExit(-1);
+  delete thread;
+}
+
+
+
+struct WORKERS_Event{
+  WaitableEvent event;
+};
+
+struct WORKERS_Event *WORKERS_newEvent(void){
+  return new WORKERS_Event;
+}
+
+void WORKERS_freeEvent(struct WORKERS_Event *event){
+  delete event;
+}
+
+void WORKERS_signalEvent(struct WORKERS_Event *event){
+  event->event.signal();
+}
+
+void WORKERS_waitEvent(struct WORKERS_Event *event){
+  event->event.wait();
+}
+
+
+
+struct WORKERS_Lock{
+  CriticalSection cs;
+};
+
+struct WORKERS_Lock *WORKERS_newLock(void){
+  return new WORKERS_Lock;
+}
+
+void WORKERS_freeLock(struct WORKERS_Lock *lock){
+  delete lock;
+}
+
+void WORKERS_lock(struct WORKERS_Lock *lock){
+  lock->cs.enter();
+}
+
+void WORKERS_unlock(struct WORKERS_Lock *lock){
+  lock->cs.exit();
+}
@@ -0,0 +1,50 @@
+
+/* A small pool of worker threads used by the fft and other heavy loops. */
+
+extern LANGSPEC int WORKERS_getNum(void);
+
+/* Calls func(arg,worker,num_workers) once for each worker=0..num_workers-1 and
+   returns when all of them are finished. Worker 0 runs in the calling thread.
+   If the pool is already busy (called from another thread at the same time),
+   all the calls are made in the calling thread instead, unless the pool is
+   busy with a call from a background thread. Then that call is waited for. */
+extern LANGSPEC void WORKERS_run(void (*func)(void *arg,int worker,int num_workers),void *arg,int num_workers);
+
+/* A thread of its own, for work that goes on at the same time as the
+   calling thread, such as reading a file. WORKERS_waitThread waits for
+   func to return, and frees the thread. */
+extern LANGSPEC struct WORKERS_Thread *WORKERS_startThread(void (*func)(void *arg),void *arg);
+extern LANGSPEC void WORKERS_waitThread(struct WORKERS_Thread *thread);
+
+/* Same, but for work nobody is waiting for, such as analysing sounds that
+   might be loaded later. The thread runs with the lowest priority, and the
+   progress bar ignores it. WORKERS_run only uses the pool in it when the
+   pool is idle, so the rest of mammut waits at most for one call. */
+extern LANGSPEC struct WORKERS_Thread *WORKERS_startBackgroundThread(void (*func)(void *arg),void *arg);
+
+/* Same, but for work the user is waiting for without watching it, such as
+   making the whole sound while a preview of it plays, or saving while
+   editing goes on. The thread runs with normal priority and uses the pool
+   like any other thread, but the progress bar ignores it. */
+extern LANGSPEC struct WORKERS_Thread *WORKERS_startJobThread(void (*func)(void *arg),void *arg);
+
+/* True if called from a thread started with WORKERS_startBackgroundThread. */
+extern LANGSPEC bool WORKERS_isBackground(void);
+
+/* True if called from a thread started with WORKERS_startBackgroundThread
+   or WORKERS_startJobThread. */
+extern LANGSPEC bool WORKERS_isQuiet(void);
+
+/* For handing work between threads. WORKERS_waitEvent returns when the
+   event has been signalled, and resets it. A signal made when nobody is
+   waiting is kept until the next wait. */
+extern LANGSPEC struct WORKERS_Event *WORKERS_newEvent(void);
+extern LANGSPEC void WORKERS_freeEvent(struct WORKERS_Event *event);
+extern LANGSPEC void WORKERS_signalEvent(struct WORKERS_Event *event);
+extern LANGSPEC void WORKERS_waitEvent(struct WORKERS_Event *event);
+
+/* For data used by more than one thread. */
+extern LANGSPEC struct WORKERS_Lock *WORKERS_newLock(void);
+extern LANGSPEC void WORKERS_freeLock(struct WORKERS_Lock *lock);
+extern LANGSPEC void WORKERS_lock(struct WORKERS_Lock *lock);
+extern LANGSPEC void WORKERS_unlock(struct WORKERS_Lock *lock);